@@ -0,0 +1,21 @@
+/* Exit with 0 if the stack grows down, and 1 if it grows up */
+
+static void* stack_address(void* p) {
+  return p;
+}
+
+/* calls through volatile function pointers cannot be inlined */
+static void* (*volatile address_of)(void*) = &stack_address;
+
+static int grows_up(void* mark) {
+  void* top = 0;
+  return (mark < address_of(&top) ? 1 : 0);
+}
+
+static int (*volatile grows_up_from)(void*) = &grows_up;
+
+int main()
+{
+  void* mark = 0;
+  return grows_up_from(address_of(&mark));
+}
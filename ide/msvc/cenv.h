@@ -24,4 +24,5 @@
 #define HAS_MEMCPY_S
 #define HAS_MEMMOVE_S
 #define HAS_STDBOOL_H
-#define HAS__ALLOCA
\ No newline at end of file
+#define HAS__ALLOCA
+#define LH_STACK_GROWS_DOWN
@@ -11,7 +11,7 @@
 #define LH_IN_ENCLAVE
   
 #include <stdbool.h>  // bool
-#include <stdint.h>   // intptr_t
+#include <stdint.h>   // intptr_t, uint64_t
 #include <stddef.h>   // ptrdiff_t
 #include <stdio.h>    // FILE*
 
@@ -221,6 +221,20 @@ typedef struct _lh_handlerdef {
 /// Handles operations yielded in `body(arg)` with the given handler definition `def`.
 lh_value lh_handle(const lh_handlerdef* def, lh_value local, lh_actionfun* body, lh_value arg);
 
+/// Handle a particular effect where `body(arg)` runs on its own separately allocated C stack.
+/// Capturing a resumption then leaves the frames of `body` in place instead of copying them,
+/// which makes general operations cheap for deep stacks. Resumptions must be resumed on the
+/// same stack as the handler was installed on. Falls back to `lh_handle` if separate stacks are not
+/// supported (or in C++), or when already running on a separate stack.
+lh_value lh_handle_separate(const lh_handlerdef* def, lh_value local, lh_actionfun* body, lh_value arg);
+
+/// Validate and analyze a handler definition ahead of its first use by the current thread.
+/// This is done automatically the first time a handler for `def` is installed, but
+/// calling it explicitly reports an invalid operation table early (as a fatal error).
+/// Since the analysis is cached, the operations should not change afterwards,
+/// except for changing an operation to #LH_OP_TAIL, #LH_OP_TAIL_NOOP, or #LH_OP_FORWARD.
+void lh_handlerdef_prepare(const lh_handlerdef* def);
+
 /// Yield an operation to the nearest enclosing handler. 
 lh_value lh_yield(lh_optag optag, lh_value arg);
 
@@ -233,6 +247,135 @@ lh_value lh_yield(lh_optag optag, lh_value arg);
 /// returns the state for the innermost enclosing handler that does not have a `NULL` operation.
 lh_value lh_yield_local(lh_optag optag);
 
+/*-----------------------------------------------------------------
+  Inline yield
+  Each thread caches the handler frame last found for an operation
+  in a small direct mapped table. An entry is valid as long as its
+  generation equals `_lh_fastgen`, which the library increments
+  whenever a handler frame is pushed or popped or the handler stack
+  is moved. A valid entry for an #LH_OP_TAIL_NOOP operation lets
+  `lh_yield_inline` call the operation function directly.
+-----------------------------------------------------------------*/
+
+#if defined(_MSC_VER) && !defined(__clang__) && !defined(__GNUC__)
+# define lh_thread_local  __declspec(thread)
+# define lh_inline        __inline
+#else
+# define lh_thread_local  __thread
+# define lh_inline        inline
+#endif
+
+/// \cond
+#define _LH_FASTCACHE_SIZE  (64)   // must be a power of 2
+
+typedef struct _lh_fastentry {
+  lh_optag   optag;
+  ptrdiff_t  gen;     // the `_lh_fastgen` at which the handler was found
+  lh_value*  local;   // the local state in the handler frame
+  lh_opfun*  opfun;   // the operation function if it is `LH_OP_TAIL_NOOP`, or `NULL` otherwise
+} _lh_fastentry;
+
+// The layout of a tail resumption; the `lh_resume` an `LH_OP_TAIL_NOOP` operation function receives.
+#define _LH_TAILRESUME  (2)
+
+typedef struct _lh_tailresume {
+  int                rkind;    // always `_LH_TAILRESUME`
+  volatile lh_value  local;    // the new local value for the handler
+  volatile bool      resumed;  // set to `true` if `lh_tail_resume` was called
+} _lh_tailresume;
+
+extern lh_thread_local _lh_fastentry _lh_fastcache[_LH_FASTCACHE_SIZE];
+extern lh_thread_local ptrdiff_t     _lh_fastgen;
+
+lh_value _lh_yield_noresume(lh_optag optag, lh_value res);
+
+static lh_inline _lh_fastentry* _lh_fastcache_entry(lh_optag optag) {
+  // optags are static structures of at least two words
+  return &_lh_fastcache[((uintptr_t)optag / (2*sizeof(void*))) % _LH_FASTCACHE_SIZE];
+}
+/// \endcond
+
+/// Yield an operation to the nearest enclosing handler, just like lh_yield().
+/// If the operation was found before and is #LH_OP_TAIL_NOOP, the operation function
+/// is called directly from the inline code; otherwise this calls lh_yield().
+static lh_inline lh_value lh_yield_inline(lh_optag optag, lh_value arg) {
+  _lh_fastentry* e = _lh_fastcache_entry(optag);
+  if (e->optag == optag && e->gen == _lh_fastgen && e->opfun != NULL) {
+    lh_value* local = e->local;
+    _lh_tailresume r;
+    r.rkind = _LH_TAILRESUME;
+    r.local = *local;
+    r.resumed = false;
+    lh_value res = e->opfun((lh_resume)&r, r.local, arg);
+    if (r.resumed) {
+      *local = r.local;
+      return res;
+    }
+    return _lh_yield_noresume(optag, res);
+  }
+  return lh_yield(optag, arg);
+}
+
+/// Return the local state of the first enclosing handler for `optag`, just like lh_yield_local().
+/// If the operation was found before the local state is read directly from the inline code.
+static lh_inline lh_value lh_yield_local_inline(lh_optag optag) {
+  _lh_fastentry* e = _lh_fastcache_entry(optag);
+  if (e->optag == optag && e->gen == _lh_fastgen) {
+    return *e->local;
+  }
+  return lh_yield_local(optag);
+}
+
+/*-----------------------------------------------------------------
+  Operation bindings
+-----------------------------------------------------------------*/
+
+/// An operation bound to its handler; see lh_bind().
+typedef struct _lh_opbinding {
+  lh_optag            optag;   ///< The bound operation.
+  ptrdiff_t           offset;  ///< (private) The offset of the handler in the handler stack.
+  uint64_t            id;      ///< (private) The identifier of the handler.
+  const lh_operation* op;      ///< (private) The operation definition in the handler.
+  ptrdiff_t           gen;     ///< (private) The `_lh_fastgen` at which `local` was valid.
+  lh_value*           local;   ///< (private) The local state in the handler frame.
+  lh_opfun*           opfun;   ///< (private) The operation function if it is #LH_OP_TAIL_NOOP, or `NULL` otherwise.
+} lh_opbinding;
+
+/// Bind an operation to the first enclosing handler for `optag`.
+/// Yielding through the binding with lh_yield_bound() then goes directly to that handler
+/// without looking it up again. The binding is only valid in the scope of the handler, as long as
+/// the handler stack below it is unchanged: it should not be used after the handler
+/// returned, from an operation function of that handler or of one below it, nor from a
+/// resumption that is resumed elsewhere. Handlers installed later on top are never
+/// considered, even if they handle the same operation. In debug builds, misuse is reported
+/// as a fatal error.
+lh_opbinding lh_bind(lh_optag optag);
+
+/// \cond
+lh_value _lh_yield_bound(lh_opbinding* binding, lh_value arg);
+lh_value _lh_yield_bound_noresume(const lh_opbinding* binding, lh_value res);
+/// \endcond
+
+/// Yield an operation through a binding; see lh_bind().
+/// As long as the handler stack is unchanged since the last yield through the binding,
+/// an #LH_OP_TAIL_NOOP operation function is called directly from the inline code.
+static lh_inline lh_value lh_yield_bound(lh_opbinding* binding, lh_value arg) {
+  if (binding->gen == _lh_fastgen && binding->opfun != NULL) {
+    lh_value* local = binding->local;
+    _lh_tailresume r;
+    r.rkind = _LH_TAILRESUME;
+    r.local = *local;
+    r.resumed = false;
+    lh_value res = binding->opfun((lh_resume)&r, r.local, arg);
+    if (r.resumed) {
+      *local = r.local;
+      return res;
+    }
+    return _lh_yield_bound_noresume(binding, res);
+  }
+  return _lh_yield_bound(binding, arg);
+}
+
 /*-----------------------------------------------------------------
   Scoped resume
 -----------------------------------------------------------------*/
@@ -260,6 +403,12 @@ lh_value      lh_call_resume(lh_resume r, lh_value local, lh_value res);
 /// Also releases the continuation and it cannot be resumed again!
 lh_value      lh_release_resume(lh_resume r, lh_value local, lh_value res);
 
+/// Compress the captured stack of a parked first-class continuation; it is decompressed
+/// transparently when resumed. This works regardless of `lh_set_resume_compact_threshold`. Returns
+/// `false` if it was not compressed, for example if it is already compressed, is not a general
+/// continuation, or if the stack is small or does not compress well.
+bool          lh_resume_compact(lh_resume r);
+
 
 /*-----------------------------------------------------------------
   Convenience functions for yield
@@ -297,6 +446,23 @@ typedef struct _yieldargs {
 /// the scope of the operation function and freed automatically afterwards.
 lh_value lh_yieldN(lh_optag optag, int argcount, ...);
 
+/// Yield with two arguments.
+/// The operation function gets a `const yieldargs*` as its argument, which is
+/// retrieved with #lh_yieldargs_fixed_value. Unlike lh_yieldN(), the arguments are 
+/// passed in the handler frame and need no adjustment for the captured stack (for any operation kind).
+/// The `yieldargs*` pointer is valid during the scope of the operation function.
+lh_value lh_yield2(lh_optag optag, lh_value arg1, lh_value arg2);
+
+/// Yield with three arguments; see lh_yield2().
+lh_value lh_yield3(lh_optag optag, lh_value arg1, lh_value arg2, lh_value arg3);
+
+/// Yield with four arguments; see lh_yield2().
+lh_value lh_yield4(lh_optag optag, lh_value arg1, lh_value arg2, lh_value arg3, lh_value arg4);
+
+/// Convert the #lh_value argument of an operation yielded with lh_yield2(), lh_yield3(), or lh_yield4() 
+/// back to a #yieldargs structure.
+#define lh_yieldargs_fixed_value(v)   ((const yieldargs*)lh_ptr_value(v))
+
 /*-----------------------------------------------------------------
   Operation tags 
 -----------------------------------------------------------------*/
@@ -350,6 +516,50 @@ void lh_register_onfatal(lh_fatalfun* onfatal);
 /// Register custom allocation functions
 void lh_register_malloc(lh_mallocfun* malloc, lh_callocfun* calloc, lh_reallocfun* realloc, lh_freefun* free);
 
+/// Keep the handler stack of the current thread allocated across outermost handlers.
+/// Normally it is allocated for every outermost `lh_handle` (or resume), and freed afterwards;
+/// a thread that handles many requests can call this once to avoid that. The pools and tables of
+/// the thread (such as the effect identifiers and the promoted operations) are kept across outermost
+/// handlers either way, and freed when the thread exits (with pthreads or on Windows; otherwise they
+/// are freed together with the handler stack).
+void lh_thread_init(void);
+
+/// Free the handler stack and the pools and tables of the current thread now.
+/// This is done automatically when a thread exits; it should never be called inside a handler.
+void lh_thread_done(void);
+
+/// Reserve room for `bytes` bytes of handler frames in the handler stack of the current thread. 
+/// The handler stack is never shrunk below this, and is kept alive as with `lh_thread_init`.
+void lh_hstack_reserve(size_t bytes);
+
+/// Set the size in bytes above which the handler stack of a thread is shrunk again once 
+/// less than a quarter of it is in use; use `SIZE_MAX` to never shrink. The default is 256kb.
+void lh_set_hstack_shrink(size_t minsize);
+
+/// Set the caps of the per-thread pool of captured stack buffers.
+/// Buffers larger than `maxsize` bytes (at most 256kb) are never pooled, and at most `maxtotal` bytes are kept 
+/// in the pool of each thread (use 0 to disable pooling). The defaults are 64kb and 1mb.
+void lh_set_cstack_pool_limits(size_t maxsize, size_t maxtotal);
+
+/// The total size in bytes of the first-class continuations, fragments, and captured stacks
+/// of the current thread that are in use (not counting the free buffers in the pool).
+size_t lh_cstack_live_size(void);
+
+/// Enable compression of the captured stacks of parked first-class continuations (see `lh_resume_compact`).
+/// Once the captured stacks of the live continuations of a thread exceed `threshold` bytes, new continuations
+/// are compressed right away. Use 0 to only compress explicitly with lh_resume_compact() (the default).
+void lh_set_resume_compact_threshold(size_t threshold);
+
+/// Enable adaptive promotion of #LH_OP_SCOPED and #LH_OP_GENERAL operations (disabled by default, with 0).
+/// Once an operation of a handler definition has resumed `threshold` times with lh_tail_resume(), and never
+/// in another way, later yields to it run like an #LH_OP_TAIL operation without capturing a resumption.
+/// If a promoted operation function still resumes with lh_call_resume() or lh_release_resume(), or a 
+/// general operation function returns without resuming (and may keep its resumption), the resumption 
+/// is captured at that point and behaves as usual; the operation is then demoted for all later yields.
+/// In C++, an exception raised by a promoted operation function is rethrown from its handler as usual.
+/// The promotion counts are shown by lh_print_stats().
+void lh_set_op_promote_threshold(size_t threshold);
+
 /// Default `malloc`.
 void* lh_malloc(size_t size);
 /// Default `calloc`.
@@ -374,6 +584,35 @@ void lh_print_stats(FILE* out);
 void lh_check_memory(FILE* out);
 #endif
 
+/// Captured stack statistics of an operation (see `lh_capture_profile`).
+typedef struct _lh_capture_stats {
+  lh_optag  optag;            ///< The operation; `optag->effect` is the effect of its handler
+  long      captures;         ///< Number of resumptions captured
+  long      resumes;          ///< Number of times those were resumed
+  size_t    captured_size;    ///< Total bytes of C stack captured
+  size_t    captured_max;     ///< Largest captured C stack in bytes
+  size_t    restored_size;    ///< Total bytes of C stack restored when resuming
+  size_t    fragment_size;    ///< Total bytes of the resuming C stack saved in fragments
+} lh_capture_stats;
+
+/// Enable or disable profiling of the C stack captured and restored per operation (disabled by default).
+void lh_capture_profile_enable(bool enable);
+
+/// Clear the capture profile.
+void lh_capture_profile_reset(void);
+
+/// Get the capture profile of at most `max` operations, sorted by the total bytes
+/// captured, restored, and saved in fragments, largest first.
+/// Returns the number of entries written to `entries`.
+size_t lh_capture_profile(lh_capture_stats* entries, size_t max);
+
+#ifdef LH_IN_ENCLAVE
+void lh_print_capture_profile(void* out, size_t max);
+#else
+/// Print the capture profile of the `max` operations that copy the most.
+void lh_print_capture_profile(FILE* out, size_t max);
+#endif
+
 /// Wait for an enter key in debug mode.
 void lh_debug_wait_for_enter();
 
@@ -486,6 +725,37 @@ void lh_debug_wait_for_enter();
 #define LH_DEFINE_VOIDOP1(effect,op,argtype) \
   void effect##_##op(argtype arg) { lh_yield(LH_OPTAG(effect,op), lh_value_##argtype(arg)); } 
 
+// Variants that use `lh_yield_inline`; best for #LH_OP_TAIL_NOOP operations.
+#define LH_DEFINE_INLINE_OP0(effect,op,restype) \
+  restype effect##_##op() { lh_value res = lh_yield_inline(LH_OPTAG(effect,op), lh_value_null); return lh_##restype##_value(res); } 
+
+#define LH_DEFINE_INLINE_OP1(effect,op,restype,argtype) \
+  restype effect##_##op(argtype arg) { lh_value res = lh_yield_inline(LH_OPTAG(effect,op), lh_value_##argtype(arg)); return lh_##restype##_value(res); }
+
+#define LH_DEFINE_INLINE_VOIDOP0(effect,op) \
+  void effect##_##op() { lh_yield_inline(LH_OPTAG(effect,op), lh_value_null); } 
+
+#define LH_DEFINE_INLINE_VOIDOP1(effect,op,argtype) \
+  void effect##_##op(argtype arg) { lh_yield_inline(LH_OPTAG(effect,op), lh_value_##argtype(arg)); } 
+
+#define LH_DEFINE_OP2(effect,op,restype,argtype1,argtype2) \
+  restype effect##_##op(argtype1 arg1, argtype2 arg2) { lh_value res = lh_yield2(LH_OPTAG(effect,op), lh_value_##argtype1(arg1), lh_value_##argtype2(arg2)); return lh_##restype##_value(res); }
+
+#define LH_DEFINE_OP3(effect,op,restype,argtype1,argtype2,argtype3) \
+  restype effect##_##op(argtype1 arg1, argtype2 arg2, argtype3 arg3) { lh_value res = lh_yield3(LH_OPTAG(effect,op), lh_value_##argtype1(arg1), lh_value_##argtype2(arg2), lh_value_##argtype3(arg3)); return lh_##restype##_value(res); }
+
+#define LH_DEFINE_OP4(effect,op,restype,argtype1,argtype2,argtype3,argtype4) \
+  restype effect##_##op(argtype1 arg1, argtype2 arg2, argtype3 arg3, argtype4 arg4) { lh_value res = lh_yield4(LH_OPTAG(effect,op), lh_value_##argtype1(arg1), lh_value_##argtype2(arg2), lh_value_##argtype3(arg3), lh_value_##argtype4(arg4)); return lh_##restype##_value(res); }
+
+#define LH_DEFINE_VOIDOP2(effect,op,argtype1,argtype2) \
+  void effect##_##op(argtype1 arg1, argtype2 arg2) { lh_yield2(LH_OPTAG(effect,op), lh_value_##argtype1(arg1), lh_value_##argtype2(arg2)); } 
+
+#define LH_DEFINE_VOIDOP3(effect,op,argtype1,argtype2,argtype3) \
+  void effect##_##op(argtype1 arg1, argtype2 arg2, argtype3 arg3) { lh_yield3(LH_OPTAG(effect,op), lh_value_##argtype1(arg1), lh_value_##argtype2(arg2), lh_value_##argtype3(arg3)); } 
+
+#define LH_DEFINE_VOIDOP4(effect,op,argtype1,argtype2,argtype3,argtype4) \
+  void effect##_##op(argtype1 arg1, argtype2 arg2, argtype3 arg3, argtype4 arg4) { lh_yield4(LH_OPTAG(effect,op), lh_value_##argtype1(arg1), lh_value_##argtype2(arg2), lh_value_##argtype3(arg3), lh_value_##argtype4(arg4)); } 
+
 #define LH_WRAP_FUN0(fun,restype) \
   lh_value wrap_##fun(lh_value arg) { (void)(arg); return lh_value_##restype(fun()); }
 
@@ -514,7 +784,7 @@ void lh_nothing();
 #ifdef __cplusplus
 class lh_raii_linear_handler {
 private:
-  ptrdiff_t id;
+  uint64_t  id;
   void*     hs;    // hstack*
   bool      do_release;
   bool      init;
@@ -533,12 +803,12 @@ public:
       (after, _lh_linear_first = false))
 
 #else
-ptrdiff_t  _lh_linear_handler_init(const lh_handlerdef* hdef, lh_value local, bool* init);
-void       _lh_linear_handler_done(ptrdiff_t id, bool init, bool do_release);
+uint64_t   _lh_linear_handler_init(const lh_handlerdef* hdef, lh_value local, bool* init);
+void       _lh_linear_handler_done(uint64_t id, bool init, bool do_release);
 
 #define LH_LINEAR_EXIT(hdef,local,do_release,after)  \
     bool _lh_linear_init = false; \
-    ptrdiff_t _lh_linear_id = _lh_linear_handler_init(hdef,local,&_lh_linear_init); \
+    uint64_t _lh_linear_id = _lh_linear_handler_init(hdef,local,&_lh_linear_init); \
     for(bool _lh_linear_first = true; \
         _lh_linear_first; \
         (after, _lh_linear_handler_done(_lh_linear_id,_lh_linear_init,do_release), \
@@ -689,7 +959,7 @@ lh_value _lh_implicit_get(lh_resume r, lh_value local, lh_value arg);
 /// Get the value of an implicit parameter.
 /// \param name The name of a previously defined implicit parameter.
 #define implicit_get(name) \
-    lh_yield_local(LH_OPTAG(name,get)) 
+    lh_yield_local_inline(LH_OPTAG(name,get)) 
 
 /// \} implicits
 
@@ -37,6 +37,11 @@
       be jumped to.
 -----------------------------------------------------------------------------*/
 
+// Enable `mmap` and `ucontext` declarations even when compiling with `-std=c99`
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+# define _DEFAULT_SOURCE
+#endif
+
 #ifdef __cplusplus
 #include <exception>
 #include <utility>
@@ -56,6 +61,33 @@
 #include <assert.h>   // assert
 #include <errno.h>    
 
+// Separate stacks (see `lh_handle_separate`) need `ucontext` to create the initial 
+// context on a new stack. C++ exceptions cannot unwind across such stacks so in C++
+// `lh_handle_separate` always uses the current stack.
+#if defined(HAS_UCONTEXT) && !defined(__cplusplus)
+# define _SEPSTACK
+# include <ucontext.h>
+# ifdef HAS_MMAP
+#  include <sys/mman.h>   // mmap
+#  include <unistd.h>     // sysconf
+#  if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#   define MAP_ANONYMOUS MAP_ANON
+#  endif
+# endif
+#endif
+
+// The pools and tables of a thread are freed when it exits (see `thread_exit_register`).
+#if defined(_WIN32)
+# define _THREAD_EXIT
+# ifndef WIN32_LEAN_AND_MEAN
+#  define WIN32_LEAN_AND_MEAN
+# endif
+# include <windows.h>   // FlsAlloc
+#elif defined(HAS_PTHREAD)
+# define _THREAD_EXIT
+# include <pthread.h>   // pthread_key_create
+#endif
+
 // maintain cheap statistics
 #define _STATS
 
@@ -63,18 +95,28 @@
 #define ref
 #define out
 
+// Check a condition at compile time (as C99 has no `static_assert`)
+#define static_check(name,cond)   typedef char static_check_##name[(cond) ? 1 : -1]
+
 // define __thread, __noinline, and __noreturn 
 #if defined(_MSC_VER) && !defined(__clang__) && !defined(__GNUC__)
+# include <intrin.h>
 # define __thread       __declspec(thread) 
 # define __noinline     __declspec(noinline)
 # define __noreturn     __declspec(noreturn)
 # define __returnstwice
+# define lh_atomic_increment(p)   _InterlockedIncrement((volatile long*)(p))   // on a 32-bit counter
+# define lh_atomic_lock(p)        (_InterlockedExchange((volatile long*)(p),1) == 0)
+# define lh_atomic_unlock(p)      _InterlockedExchange((volatile long*)(p),0)
 #else
 // assume gcc or clang 
 // __thread is already defined
 # define __noinline     __attribute__((noinline))
 # define __noreturn     __attribute__((noreturn))
 # define __returnstwice __attribute__((returns_twice))
+# define lh_atomic_increment(p)   __atomic_add_fetch(p, 1, __ATOMIC_RELAXED)
+# define lh_atomic_lock(p)        (__atomic_exchange_n(p, 1, __ATOMIC_ACQUIRE) == 0)
+# define lh_atomic_unlock(p)      __atomic_store_n(p, 0, __ATOMIC_RELEASE)
 #endif 
 
 #ifdef __cplusplus
@@ -159,10 +201,13 @@ typedef char bool;
 // Basic types
 typedef unsigned char byte;
 typedef ptrdiff_t     count;   // signed natural machine word
+typedef uint64_t      handlerid; // unique handler identifier (see `handler_newid`)
 
 // forward declarations
 struct _handler;
 typedef struct _handler handler;
+struct _sepstack;
+typedef struct _sepstack sepstack;
 
 // A handler stack; Separate from the C-stack so it can be searched even if the C-stack contains fragments
 // Handler frames are variable size so we use a `byte*` for the frames.
@@ -198,7 +243,8 @@ typedef struct _fragment {
 typedef enum _resumekind {
   GeneralResume,       // `lh_resume` is a `resume`
   ScopedResume,     // `lh_resume` is a `resume` but automatically released once out of scope
-  TailResume        // `lh_resume` is a `tailresume`
+  TailResume,       // `lh_resume` is a `tailresume`
+  PromotedResume    // `lh_resume` is a `resume` that is not captured (yet) (see `promoted_yield`)
 } resumekind;
 
 // Typedef'ed to `lh_resume` in the header. 
@@ -211,6 +257,18 @@ struct _lh_resume {
 // Every resume kind starts with an `lhresume` field (for safe upcasting)
 #define to_lhresume(r) (&(r)->lhresume)
 
+// Where the resumption of a promoted operation is captured if it is used other than with 
+// `lh_tail_resume` after all: the C stack and handler frames stay in place until then.
+typedef struct _promotedyield {
+  const void*        top;         // the top of the C stack at the yield
+  count              hcount;      // the size of the handler stack at the yield
+  count              htopsize;    // the size of its top frame
+  count              skipped;     // the handler is `skipped` bytes down from the top
+  volatile lh_value  local;       // the new local value for the handler
+  volatile bool      resumed;     // set to `true` if `lh_tail_resume` was called
+  volatile bool      released;    // set to `true` if `lh_release` was called
+} promotedyield;
+
 // A first-class resumption
 typedef struct _resume {
   struct _lh_resume  lhresume;    // contains the kind: always `GeneralResume` or `ScopedResume` (must be first field, used for casts)
@@ -221,15 +279,48 @@ typedef struct _resume {
   volatile lh_value  arg;         // the argument to `resume` is passed through `arg`.
   count              resumptions; // how often was this resumption resumed?
   struct exn_frame*  exn_bottom;  // 
+  sepstack*          sstack;      // if not NULL, the part of the captured stack that lives on a separate stack
+  struct _cstack     sepcstack;   // the captured frames on `sstack`; `frames` is NULL if they are still in place
+  ptrdiff_t          blocksize;   // size of the allocated block; it also contains the captured frames (see `resume_alloc`)
+  struct _resume*    image;       // if not NULL, `cstack.frames` only holds the differences with the captured stack of `image`
+  bool               compressed;  // if true, `cstack.frames` holds the compressed captured stack (see `lh_resume_compact`)
+  bool               hstack_plain; // if true, the captured handler frames need no acquiring when copied (known after the first copy)
+  ptrdiff_t          encsize;     // the size of `cstack.frames` if it is encoded (`image != NULL` or `compressed`)
+  count              imagerefs;   // number of resumptions that use our captured stack as their `image`
+  lh_optag           optag;       // the operation that captured this resumption (used for profiling)
+  const lh_operation* op;         // the operation definition that captured this resumption (used for promotion)
+  promotedyield      promoted;    // where to capture a `PromotedResume`
 } resume;
 
 // An optimized resumption that can only used for tail-call resumptions (`lh_tail_resume`).
+// `lh_yield_inline` in the header sets these up as an `_lh_tailresume` (which has the same layout).
 typedef struct _tailresume {
   struct _lh_resume  lhresume;    // the kind: always `TailResume` (must be first field, used for casts)
   volatile lh_value  local;       // the new local value for the handler
   volatile bool      resumed;     // set to `true` if `lh_tail_resume` was called
 } tailresume;
 
+// `lh_yield_inline` relies on the same layout in release builds too
+static_check(tailresume_kind, TailResume == _LH_TAILRESUME);
+static_check(tailresume_rkind, offsetof(tailresume, lhresume.rkind) == offsetof(_lh_tailresume, rkind) &&
+                               sizeof(((tailresume*)0)->lhresume.rkind) == sizeof(((_lh_tailresume*)0)->rkind));
+static_check(tailresume_local, offsetof(tailresume, local) == offsetof(_lh_tailresume, local));
+static_check(tailresume_resumed, offsetof(tailresume, resumed) == offsetof(_lh_tailresume, resumed));
+static_check(tailresume_size, sizeof(tailresume) == sizeof(_lh_tailresume));
+
+// A tail resumption can only be resumed with `lh_tail_resume`.
+static bool is_tailresume(lh_resume r) {
+  return (r->rkind == TailResume);
+}
+
+// The arguments of `lh_yield2/3/4`; passed to operation functions as a `yieldargs*`.
+#define YIELD_MAXARGS  (4)
+
+typedef struct _fixedargs {
+  int       argcount;               // 0 for a yield of a single argument
+  lh_value  args[YIELD_MAXARGS];
+} fixedargs;
+
 
 
 // A handler; there are four kinds of frames
@@ -253,24 +344,44 @@ LH_DEFINE_EFFECT0(__fragment)
 LH_DEFINE_EFFECT0(__scoped)
 LH_DEFINE_EFFECT0(__skip)
 
+// The flags of an effect handler summarize its handler definition (see `hdef_info`).
+#define HDEF_TAILONLY   (0x01)   // all operations forward or tail resume (no jump point needed)
+#define HDEF_ACQUIRE    (0x02)   // has a `local_acquire` function
+#define HDEF_RELEASE    (0x04)   // has a `local_release` function
+#define HDEF_RESULT     (0x08)   // has a `resultfun`
+#define HDEF_KIND(k)    (0x100U << (k))  // has an operation of kind `k`
+
+#define HDEF_TAILKINDS  (HDEF_KIND(LH_OP_FORWARD) | HDEF_KIND(LH_OP_TAIL_NOOP) | HDEF_KIND(LH_OP_TAIL))
+
 // Regular effect handler.
+// The fields used when finding, pushing, and popping handlers come first so they 
+// share a cache line; the fields only used when yielding to the handler follow.
 typedef struct _effecthandler {
   struct _handler      handler;
-  lh_jmp_buf           entry;       // used to jump back to a handler 
-  count                id;          // uniquely identifies the handler (cannot always use pointer due to reallocation)
   const lh_handlerdef* hdef;        // operation definitions
+  count                prevsame;    // offset in the `hframes` of the next outer handler for the same effect (or -1)
+  count                effectid;    // the thread's identifier of the effect
+  unsigned             flags;       // the HDEF_xxx flags of the handler definition
+  lh_value             local;   
+  sepstack*            sstack;      // if not NULL, the action runs on this separate stack
+  handlerid            id;          // uniquely identifies the handler (cannot always use pointer due to reallocation)
+  void*                stackbase;   // pointer to the c-stack just below the handler
+  struct exn_frame*    exn_frame;
   volatile lh_value    arg;         // the yield argument is passed here
   const lh_operation*  arg_op;      // the yielded operation is passed here
   resume*              arg_resume;  // the resumption function for the yielded operation
-  void*                stackbase;   // pointer to the c-stack just below the handler
-  lh_value             local;   
-  struct exn_frame*    exn_frame;
+  fixedargs            arg_fixed;   // the arguments of `lh_yield2/3/4` are passed here (if `argcount > 0`)
+  lh_jmp_buf           entry;       // used to jump back to a handler 
 } effecthandler;
 
 // A skip handler.
 typedef struct _skiphandler {
   struct _handler      handler;
   count                toskip;      // when looking for an operation handler, skip the next `toskip` bytes.
+  count                gen;         // the generation of the handler stack started by pushing this frame
+  count                prevgen;     // the generation of the handler stack below this frame
+  count                prevskip;    // offset of the top most skip frame below this frame (or -1)
+  count                nextskip;    // offset of the top most skip frame below the skipped region (or -1)
 } skiphandler;
 
 // A fragment handler just contains a `fragment`.
@@ -437,8 +548,15 @@ static __noinline void* get_stack_top() {
   return _stack_address(&top);
 }
 
-// true if the stack grows up
-static bool stackup = false;
+// true if the stack grows up; when `configure` detected the direction
+// this is a constant so the stack helpers below are constant-folded.
+#if defined(LH_STACK_GROWS_DOWN)
+static const bool stackup = false;
+#elif defined(LH_STACK_GROWS_UP)
+static const bool stackup = true;
+#else
+static bool stackup = false;   // inferred at runtime by `infer_stackdir`
+#endif
 
 // base of our c stack
 static const void* stackbottom = NULL;
@@ -447,7 +565,11 @@ static const void* stackbottom = NULL;
 static __noinline void infer_stackdir() {
   void* mark = _stack_address(&mark);
   void* top  = get_stack_top();
+  #if defined(LH_STACK_GROWS_DOWN) || defined(LH_STACK_GROWS_UP)
+  if ((mark < top) != stackup) fatal(EFAULT, "the stack direction does not match the configured direction");
+  #else
   stackup = (mark < top);
+  #endif
   stackbottom = mark;
 }
 
@@ -474,9 +596,19 @@ static bool stack_isbelow(const void* p, const void* q) {
   return (stackup ? p < q : p > q);
 }
 
+// forward
+static sepstack* sepstack_of(const void* p);
+static const void* sepstack_parent_top(const sepstack* s);
+
 // Does this pointer point to the C stack?
 static bool in_cstack(const void* p) {
   const void* top = get_stack_top();
+  const sepstack* s = sepstack_of(top);
+  if (s != NULL) {
+    // running on a separate stack: check both the separate stack and the parent stack
+    if (sepstack_of(p) == s) return !stack_isbelow(top, p);
+    top = sepstack_parent_top(s);
+  }
   return !(stack_isbelow(top, p) || stack_isbelow(p, stackbottom));
 }
 
@@ -530,12 +662,38 @@ static struct {
   count rcont_released_size;
 
   long operations;
+  long operations_cached;
   count hstack_max;
+  long hstack_shrunk;
+
+  long sepstack_allocated;
+  long sepstack_captured;
+  long sepstack_resumed_inplace;
+  long sepstack_copied;
+  count sepstack_copied_size;
+
+  long cstack_pool_hits;
+  long cstack_pool_misses;
+  long cstack_pool_discarded;
+
+  long rcont_captured_delta;
+  count rcont_captured_delta_saved;
+  long rcont_compressed;
+  count rcont_compressed_saved;
+  long rcont_elided_fragment;
+
+  long ops_promoted;
+  long ops_demoted;
+  long operations_promoted;
 } stats = {
     0, 0, 0, 0, 0,
     0, 0, 0, 
     0, 0,
-    0, 0, 
+    0, 0, 0, 0,
+    0, 0, 0, 0, 0,
+    0, 0, 0,
+    0, 0, 0, 0, 0,
+    0, 0, 0,
 };
 
 #ifdef LH_IN_ENCLAVE
@@ -569,18 +727,49 @@ void lh_print_stats(FILE* h) {
     fprintf(h, "    resume    :%6li\n", stats.rcont_captured_resume);
     fprintf(h, "    scoped    :%6li\n", stats.rcont_captured_scoped);
     fprintf(h, "    fragment  :%6li\n", stats.rcont_captured_fragment);
+    fprintf(h, "      elided  :%6li\n", stats.rcont_elided_fragment);
     fprintf(h, "    empty     :%6li\n", stats.rcont_captured_empty);
+    fprintf(h, "    delta     :%6li\n", stats.rcont_captured_delta);
+    fprintf(h, "      saved   :%6li kb\n", (long)((stats.rcont_captured_delta_saved + 1023) / 1024));
+    fprintf(h, "    compressed:%6li\n", stats.rcont_compressed);
+    fprintf(h, "      saved   :%6li kb\n", (long)((stats.rcont_compressed_saved + 1023) / 1024));
     fprintf(h, "    total size:%6li kb\n", (long)((stats.rcont_captured_size + 1023) / 1024));
     fprintf(h, "    avg size  :%6li bytes\n", (long)((stats.rcont_captured_size / (captured > 0 ? captured : 1))));
     if (captured != stats.rcont_released) {
       fprintf(h, "  released    :%li\n", stats.rcont_released);
       fprintf(h, "    total size:%6li kb\n", (long)((stats.rcont_released_size + 1023) / 1024));
     }
-    fprintf(h, "  hstack max  :%li kb\n", (long)(stats.hstack_max + 1023) /1024);
+  }
+  if (stats.hstack_max > 0) {
+    fputs("handler stack:\n", h);
+    fprintf(h, "  max size    :%6li kb\n", (long)(stats.hstack_max + 1023) / 1024);
+    fprintf(h, "  current size:%6li kb\n", (long)(__hstack.size + 1023) / 1024);
+    fprintf(h, "  shrunk      :%6li\n", stats.hstack_shrunk);
+  }
+  if (stats.sepstack_allocated > 0) {
+    fputs("separate stacks:\n", h);
+    fprintf(h, "  allocated   :%6li\n", stats.sepstack_allocated);
+    fprintf(h, "  captured    :%6li\n", stats.sepstack_captured);
+    fprintf(h, "  in place    :%6li\n", stats.sepstack_resumed_inplace);
+    fprintf(h, "  copied      :%6li\n", stats.sepstack_copied);
+    fprintf(h, "    total size:%6li kb\n", (long)((stats.sepstack_copied_size + 1023) / 1024));
+  }
+  if (stats.cstack_pool_hits + stats.cstack_pool_misses > 0) {
+    fputs("cstack pool:\n", h);
+    fprintf(h, "  hits        :%6li\n", stats.cstack_pool_hits);
+    fprintf(h, "  misses      :%6li\n", stats.cstack_pool_misses);
+    fprintf(h, "  discarded   :%6li\n", stats.cstack_pool_discarded);
+  }
+  if (stats.ops_promoted + stats.ops_demoted > 0) {
+    fputs("promotion:\n", h);
+    fprintf(h, "  promoted    :%6li\n", stats.ops_promoted);
+    fprintf(h, "  demoted     :%6li\n", stats.ops_demoted);
+    fprintf(h, "  operations  :%6li\n", stats.operations_promoted);
   }
   # ifdef _DEBUG_STATS
   fputs("operations:\n", h);
   fprintf(h, "  total       :%6li\n", stats.operations);
+  fprintf(h, "  cached      :%6li\n", stats.operations_cached);
   # endif
   fputs(line, h);
   #endif
@@ -603,9 +792,395 @@ void lh_check_memory(FILE* h) {
 }
 #endif
 
+/*-----------------------------------------------------------------
+  Pointer tables
+  Small open addressing hash tables with linear probing for entries
+  keyed on a pointer, such as an effect or an operation. Every entry
+  starts with its key where a `NULL` key marks an empty slot. A table
+  doubles in size before it becomes more than half full.
+-----------------------------------------------------------------*/
+
+typedef struct _ptrtable {
+  byte*   entries;
+  size_t  size;     // the number of slots; a power of 2
+  size_t  count;    // the number of used slots
+} ptrtable;
+
+#define PTRTABLE_EMPTY  { NULL, 0, 0 }
+
+static size_t ptrtable_hash(const void* key) {
+  uintptr_t h = (uintptr_t)key;
+  return (size_t)(h ^ (h >> 7) ^ (h >> 15));
+}
+
+static const void* ptrtable_key(const byte* entry) {
+  const void* key;
+  memcpy(&key, entry, sizeof(key));
+  return key;
+}
+
+// Return the entry of `key` in a table of entries of `esize` bytes, or the empty slot where it belongs.
+static byte* ptrtable_slot(const ptrtable* t, const void* key, size_t esize) {
+  size_t i = ptrtable_hash(key) & (t->size - 1);
+  for (;;) {
+    byte* entry = t->entries + i*esize;
+    const void* k = ptrtable_key(entry);
+    if (k == key || k == NULL) return entry;
+    i = (i + 1) & (t->size - 1);
+  }
+}
+
+// Find the entry of `key`; returns `NULL` if it has none.
+static void* ptrtable_find(const ptrtable* t, const void* key, size_t esize) {
+  if (t->count == 0) return NULL;
+  byte* entry = ptrtable_slot(t, key, esize);
+  return (ptrtable_key(entry) == NULL ? NULL : entry);
+}
+
+// Find the entry of `key`; if it has none, a zeroed entry is added (and `added` is set to `true`).
+static void* ptrtable_insert(ref ptrtable* t, const void* key, size_t esize, out bool* added) {
+  if (2*(t->count + 1) > t->size) {
+    // grow the table and rehash
+    ptrtable old = *t;
+    t->size = (old.size == 0 ? 64 : 2*old.size);
+    t->entries = (byte*)checked_malloc(t->size * esize);
+    memset(t->entries, 0, t->size * esize);
+    for (size_t i = 0; i < old.size; i++) {
+      const byte* entry = old.entries + i*esize;
+      if (ptrtable_key(entry) != NULL) memcpy(ptrtable_slot(t, ptrtable_key(entry), esize), entry, esize);
+    }
+    if (old.entries != NULL) checked_free(old.entries);
+  }
+  byte* entry = ptrtable_slot(t, key, esize);
+  bool isnew = (ptrtable_key(entry) == NULL);
+  if (isnew) {
+    memcpy(entry, &key, sizeof(key));
+    t->count++;
+  }
+  if (added != NULL) *added = isnew;
+  return entry;
+}
+
+static void ptrtable_free(ref ptrtable* t) {
+  if (t->entries != NULL) checked_free(t->entries);
+  t->entries = NULL;
+  t->size = 0;
+  t->count = 0;
+}
+
+
+/*-----------------------------------------------------------------
+  Capture profile
+  When enabled, the bytes of C stack that are captured and restored
+  are attributed to the operation that captured the resumption. The
+  entries are kept in an open addressing hash table on the `optag`
+  that is shared by all threads and protected by a spin lock.
+-----------------------------------------------------------------*/
+
+static bool              profile_enabled = false;
+static ptrtable          profile = PTRTABLE_EMPTY;   // of `lh_capture_stats`
+static volatile long     profile_locked = 0;
+
+static void profile_lock() {
+  while (!lh_atomic_lock(&profile_locked)) { /* spin */ }
+}
+
+static void profile_unlock() {
+  lh_atomic_unlock(&profile_locked);
+}
+
+// Find the profile entry of an operation; creates it if it did not exist yet.
+// Should be called with the profile locked.
+static lh_capture_stats* profile_entry(lh_optag optag) {
+  return (lh_capture_stats*)ptrtable_insert(&profile, optag, sizeof(lh_capture_stats), NULL);
+}
+
+static void profile_capture(lh_optag optag, ptrdiff_t size) {
+  profile_lock();
+  lh_capture_stats* e = profile_entry(optag);
+  e->captures++;
+  e->captured_size += (size_t)size;
+  if ((size_t)size > e->captured_max) e->captured_max = (size_t)size;
+  profile_unlock();
+}
+
+static void profile_restore(lh_optag optag, ptrdiff_t size) {
+  profile_lock();
+  lh_capture_stats* e = profile_entry(optag);
+  e->resumes++;
+  e->restored_size += (size_t)size;
+  profile_unlock();
+}
+
+static void profile_fragment(lh_optag optag, ptrdiff_t size) {
+  profile_lock();
+  profile_entry(optag)->fragment_size += (size_t)size;
+  profile_unlock();
+}
+
+static size_t profile_total(const lh_capture_stats* e) {
+  return e->captured_size + e->restored_size + e->fragment_size;
+}
+
+static int profile_compare(const void* p, const void* q) {
+  size_t x = profile_total((const lh_capture_stats*)p);
+  size_t y = profile_total((const lh_capture_stats*)q);
+  return (x > y ? -1 : (x < y ? 1 : 0));
+}
+
+void lh_capture_profile_enable(bool enable) {
+  profile_enabled = enable;
+}
+
+void lh_capture_profile_reset() {
+  profile_lock();
+  ptrtable old = profile;
+  profile.entries = NULL;
+  profile.size = 0;
+  profile.count = 0;
+  profile_unlock();
+  ptrtable_free(&old);
+}
+
+size_t lh_capture_profile(lh_capture_stats* entries, size_t max) {
+  if (max == 0) return 0;
+  profile_lock();
+  lh_capture_stats* sorted = NULL;
+  size_t n = 0;
+  if (profile.count > 0) {
+    sorted = (lh_capture_stats*)checked_malloc(profile.count * sizeof(lh_capture_stats));
+    const lh_capture_stats* table = (const lh_capture_stats*)profile.entries;
+    for (size_t i = 0; i < profile.size; i++) {
+      if (table[i].optag != NULL) sorted[n++] = table[i];
+    }
+  }
+  profile_unlock();
+  if (n == 0) return 0;
+  qsort(sorted, n, sizeof(lh_capture_stats), &profile_compare);
+  if (n > max) n = max;
+  memcpy(entries, sorted, n * sizeof(lh_capture_stats));
+  checked_free(sorted);
+  return n;
+}
+
+#ifdef LH_IN_ENCLAVE
+void lh_print_capture_profile(void* h, size_t max) {
+  /* void */
+}
+#else
+void lh_print_capture_profile(FILE* h, size_t max) {
+  if (h == NULL) h = stderr;
+  profile_lock();
+  if (max > profile.count) max = profile.count;
+  profile_unlock();
+  if (max == 0) return;
+  lh_capture_stats* entries = (lh_capture_stats*)checked_malloc(max * sizeof(lh_capture_stats));
+  size_t n = lh_capture_profile(entries, max);
+  fputs("capture profile:\n", h);
+  fprintf(h, "  %-24s %9s %9s %10s %10s %10s %10s\n", "operation", "captures", "resumes", "captured", "max", "restored", "fragments");
+  for (size_t i = 0; i < n; i++) {
+    const lh_capture_stats* e = &entries[i];
+    fprintf(h, "  %-24s %9li %9li %7lu kb %10lu %7lu kb %7lu kb\n",
+      lh_optag_name(e->optag), e->captures, e->resumes,
+      (unsigned long)((e->captured_size + 1023) / 1024), (unsigned long)e->captured_max,
+      (unsigned long)((e->restored_size + 1023) / 1024), (unsigned long)((e->fragment_size + 1023) / 1024));
+  }
+  checked_free(entries);
+}
+#endif
+
+/*-----------------------------------------------------------------
+  Operation promotion
+  When enabled, every resumption captured by an `LH_OP_SCOPED` or
+  `LH_OP_GENERAL` operation is watched. Once an operation has been
+  resumed `promote_threshold` times through `lh_tail_resume`, and never
+  in any other way, later yields to it run just like an `LH_OP_TAIL`
+  operation without capturing a resumption (see `promoted_yield`). An
+  operation that still uses its promoted resumption otherwise is
+  demoted again.
+  The entries are kept per thread in an open addressing hash table
+  on the operation definition.
+-----------------------------------------------------------------*/
+
+#define PROMOTE_REJECTED  (-1)   // the operation was resumed other than with `lh_tail_resume`
+
+typedef struct _promoteinfo {
+  const lh_operation* op;
+  count               tails;     // the number of tail resumptions seen, or `PROMOTE_REJECTED`
+} promoteinfo;
+
+static size_t          promote_threshold = 0;   // 0: disabled
+static __thread ptrtable promotes = PTRTABLE_EMPTY;   // of `promoteinfo`
+static __thread resume*  promoted_spare = NULL;    // a resumption header to reuse in `promoted_yield`
+
+// Find the promotion entry of an operation; creates it if it did not exist yet.
+static promoteinfo* promote_entry(const lh_operation* op) {
+  return (promoteinfo*)ptrtable_insert(&promotes, op, sizeof(promoteinfo), NULL);
+}
+
+// Is a scoped or general operation promoted to a tail resumptive operation?
+static bool op_is_promoted(const lh_operation* op) {
+  const promoteinfo* p = (const promoteinfo*)ptrtable_find(&promotes, op, sizeof(promoteinfo));
+  return (p != NULL && p->tails >= 0 && (size_t)p->tails >= promote_threshold);
+}
+
+// The resumption `r` is resumed; `tail` is true for `lh_tail_resume`.
+static void promote_observe(const resume* r, bool tail) {
+  if (r->op == NULL) return;
+  promoteinfo* p = promote_entry(r->op);
+  if (p->tails == PROMOTE_REJECTED) return;
+  if (!tail) {
+    p->tails = PROMOTE_REJECTED;
+  }
+  else if (r->resumptions == 0) {
+    p->tails++;
+    #ifdef _STATS
+    if ((size_t)p->tails == promote_threshold) stats.ops_promoted++;
+    #endif
+  }
+}
+
+// A promoted operation used its resumption other than with `lh_tail_resume`.
+static void promote_demote(const lh_operation* op) {
+  promote_entry(op)->tails = PROMOTE_REJECTED;
+  #ifdef _STATS
+  stats.ops_demoted++;
+  #endif
+}
+
+void lh_set_op_promote_threshold(size_t threshold) {
+  promote_threshold = threshold;
+}
+
+
 /*-----------------------------------------------------------------
   Cstack
+  Captured stacks tend to have very similar sizes, so instead of 
+  calling `malloc` and `free` on every capture we keep a per-thread 
+  pool of free frame buffers in size classes. There are 4 size classes 
+  for every power of two (so at most 25% is wasted); buffers larger 
+  than `cstack_pool_maxsize` are never pooled.
 -----------------------------------------------------------------*/
+
+#define CSTACK_POOL_MINSIZE   (256)         // size of the smallest class
+#define CSTACK_POOL_MAXSIZE   (256*1024)    // size of the largest class
+#define CSTACK_POOL_CLASSES   (41)          // number of classes from MINSIZE upto MAXSIZE
+
+// Default caps; can be changed with `lh_set_cstack_pool_limits`
+static size_t cstack_pool_maxsize  = 64*1024;     // larger buffers are not pooled
+static size_t cstack_pool_maxtotal = 1024*1024;   // maximum total size of the free buffers per thread
+
+typedef struct _cstack_block {
+  struct _cstack_block* next;
+} cstack_block;
+
+static __thread struct {
+  cstack_block* free[CSTACK_POOL_CLASSES];
+  size_t        total;    // total size of the free buffers
+} cstack_pool;
+
+static __thread ptrdiff_t cstack_live = 0;  // total size of the buffers in use (allocated minus freed by this thread)
+
+// Return the size class of a buffer of `size` bytes (`<= CSTACK_POOL_MAXSIZE`) 
+// and set `csize` to the size of that class.
+static count cstack_pool_class(size_t size, out size_t* csize) {
+  if (size <= CSTACK_POOL_MINSIZE) {
+    *csize = CSTACK_POOL_MINSIZE;
+    return 0;
+  }
+  size_t w = size - 1;
+  count  b = 0;
+  while ((w >> b) > 7) b++;        // now `4 <= (w >> b) <= 7`
+  size_t top = (w >> b) + 1;
+  *csize = top << b;
+  return ((b - 6) * 4) + (count)(top - 5) + 1;
+}
+
+// The size of buffers in class `cls`.
+static size_t cstack_pool_classsize(count cls) {
+  if (cls == 0) return CSTACK_POOL_MINSIZE;
+  return (size_t)(5 + ((cls - 1) % 4)) << (6 + ((cls - 1) / 4));
+}
+
+// Allocate a buffer for `size` bytes of stack frames.
+// Note: we always allocate the full class size so a buffer can be pooled
+// even if the caps change between allocation and freeing.
+static byte* cstack_frames_alloc(ptrdiff_t size) {
+  assert(size > 0);
+  if ((size_t)size > CSTACK_POOL_MAXSIZE) {
+    cstack_live += size;
+    return (byte*)checked_malloc(size);
+  }
+  size_t csize;
+  count  cls = cstack_pool_class((size_t)size, &csize);
+  cstack_live += (ptrdiff_t)csize;
+  cstack_block* b = cstack_pool.free[cls];
+  if (b != NULL && (size_t)size <= cstack_pool_maxsize) {
+    cstack_pool.free[cls] = b->next;
+    cstack_pool.total -= csize;
+    #ifdef _STATS
+    stats.cstack_pool_hits++;
+    #endif
+    return (byte*)b;
+  }
+  #ifdef _STATS
+  stats.cstack_pool_misses++;
+  #endif
+  return (byte*)checked_malloc(csize);
+}
+
+// Free a buffer of stack frames that was allocated for `size` bytes.
+// Buffers are only pooled while the thread has a handler stack; otherwise (e.g. when
+// releasing a parked resumption outside any handler) nothing would trim the pool again.
+static void cstack_frames_free(byte* frames, ptrdiff_t size) {
+  assert(frames != NULL && size > 0);
+  if ((size_t)size > CSTACK_POOL_MAXSIZE) {
+    cstack_live -= size;
+  }
+  else {
+    size_t csize;
+    count  cls = cstack_pool_class((size_t)size, &csize);
+    cstack_live -= (ptrdiff_t)csize;
+    if (__hstack.size > 0 && (size_t)size <= cstack_pool_maxsize && cstack_pool.total + csize <= cstack_pool_maxtotal) {
+      cstack_block* b = (cstack_block*)frames;
+      b->next = cstack_pool.free[cls];
+      cstack_pool.free[cls] = b;
+      cstack_pool.total += csize;
+      return;
+    }
+    #ifdef _STATS
+    stats.cstack_pool_discarded++;
+    #endif
+  }
+  checked_free(frames);
+}
+
+// Free pooled buffers that are too large, and until the pool holds at most `maxtotal` bytes.
+static void cstack_pool_trim(size_t maxtotal) {
+  count cls;
+  for (cls = CSTACK_POOL_CLASSES - 1; cls >= 0; cls--) {
+    bool toolarge = (cstack_pool_classsize(cls) > cstack_pool_maxsize);
+    while (cstack_pool.free[cls] != NULL && (toolarge || cstack_pool.total > maxtotal)) {
+      cstack_block* b = cstack_pool.free[cls];
+      cstack_pool.free[cls] = b->next;
+      cstack_pool.total -= cstack_pool_classsize(cls);
+      checked_free(b);
+    }
+  }
+}
+
+// Total size of the resumptions, fragments, and captured stacks that are in use.
+size_t lh_cstack_live_size() {
+  return (cstack_live > 0 ? (size_t)cstack_live : 0);
+}
+
+// Set the caps of the captured stack pool.
+void lh_set_cstack_pool_limits(size_t maxsize, size_t maxtotal) {
+  cstack_pool_maxsize = (maxsize > CSTACK_POOL_MAXSIZE ? CSTACK_POOL_MAXSIZE : maxsize);
+  cstack_pool_maxtotal = maxtotal;
+  cstack_pool_trim(maxtotal);
+}
+
 static void cstack_init(ref cstack* cs) {
   assert(cs != NULL);
   cs->base = NULL;
@@ -616,7 +1191,7 @@ static void cstack_init(ref cstack* cs) {
 static void cstack_free(ref cstack* cs) {
   assert(cs != NULL);
   if (cs->frames != NULL) {
-    checked_free(cs->frames);
+    cstack_frames_free(cs->frames, cs->size);
     cs->frames = NULL;
     cs->size = 0;
   }
@@ -646,6 +1221,308 @@ static ptrdiff_t ptrdiff(const void* p, const void* q) {
 
 
 
+/*-----------------------------------------------------------------
+  Separate stacks
+  With `lh_handle_separate` the action of a handler runs on its own 
+  separately allocated C stack. When yielding to a handler from such 
+  stack, the frames on the separate stack are not copied but stay
+  in place: the stack is then "owned" by the captured resumption. Only
+  the (usually small) part of the parent stack between the handler and
+  the point where we switched stacks is copied as usual. This "bridge"
+  contains the `handle_with` frame that the action returns to.
+
+  If an owned resumption is resumed while it is still referenced (i.e.
+  it can be resumed again), or if another resumption needs to run on
+  the same stack, the frames are copied to the heap after all; from then
+  on the resumption behaves as a regular captured stack that is restored
+  at the exact same location (in the separate stack).
+
+  Separate stacks are not nested: `lh_handle_separate` called while
+  running on a separate stack just runs the action on the current stack.
+  Resumptions must be resumed on the same stack as the handler that
+  captured them was installed on.
+-----------------------------------------------------------------*/
+
+#ifdef _SEPSTACK
+
+// Size of a separate stack; memory is reserved but only committed when used.
+#define SEPSTACK_SIZE     (1024*1024)
+// Maximum number of unused stacks kept around per thread for reuse.
+#define SEPSTACK_POOLMAX  (8)
+
+struct _sepstack {
+  struct _sepstack*  next;        // next in the per-thread list of all separate stacks
+  count              refcount;    // number of handler frames that refer to this stack; 0 if unused
+  byte*              mem;         // the allocated memory, including the guard page
+  size_t             memsize;     // the size of the allocated memory
+  const byte*        lo;          // the lowest usable address of the stack
+  const byte*        hi;          // just beyond the highest usable address of the stack
+  const void*        stackbase;   // the bottom of the frames of a running action 
+  const void*        parent_top;  // the top of the parent stack when switching to this stack
+  lh_jmp_buf*        done;        // jump here (in the parent stack) when the action returns
+  volatile lh_value  res;         // the result of the action is passed through `res`
+  resume*            owner;       // the resumption whose frames are in place on this stack (or NULL)
+  lh_jmp_buf         start;       // jump here to start running an action on this stack
+};
+
+// thread local list of all allocated separate stacks
+static __thread sepstack* __sepstacks = NULL;
+static __thread count     __sepstacks_unused = 0;
+
+// Parameters passed when (re)starting a separate stack
+static __thread struct {
+  sepstack*     stack;
+  lh_jmp_buf*   creator;
+  lh_actionfun* action;
+  lh_value      arg;
+} sepstack_launch;
+
+// Return the separate stack that contains `p`, or `NULL` if it is not on a separate stack.
+static sepstack* sepstack_of(const void* p) {
+  sepstack* s;
+  for (s = __sepstacks; s != NULL; s = s->next) {
+    if ((const byte*)p >= s->lo && (const byte*)p < s->hi) return s;
+  }
+  return NULL;
+}
+
+// Are two stack pointers on the same C stack?
+static bool stack_same(const void* p, const void* q) {
+  return (__sepstacks == NULL || sepstack_of(p) == sepstack_of(q));
+}
+
+static const void* sepstack_parent_top(const sepstack* s) {
+  return s->parent_top;
+}
+
+// Run the action on a separate stack and return its result to the parent stack.
+static __noinline __noreturn void sepstack_run_action(sepstack* s, void* base) {
+  s->stackbase = base;
+  lh_value res = sepstack_launch.action(sepstack_launch.arg);
+  s->res = res;
+  _lh_longjmp(*s->done, 1);
+}
+
+// The initial function on a new separate stack; it sets the `start` entry and returns
+// to the creator. Every action is later started by jumping to this `start` entry.
+static void sepstack_entry(void) {
+  void* base = NULL;
+  sepstack* s = sepstack_launch.stack;
+  if (_lh_setjmp(s->start) == 0) {
+    _lh_longjmp(*sepstack_launch.creator, 1);
+  }
+  sepstack_run_action(sepstack_launch.stack, &base);
+}
+
+static sepstack* sepstack_new(void) {
+  size_t size = SEPSTACK_SIZE;
+  size_t guard;
+  byte*  mem;
+  #ifdef HAS_MMAP
+  long pagesize = sysconf(_SC_PAGESIZE);
+  guard = (pagesize > 0 ? (size_t)pagesize : 4096);
+  mem = (byte*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == (byte*)MAP_FAILED) fatal(ENOMEM, "cannot allocate a separate stack");
+  // protect the end of the stack
+  mprotect(stackup ? mem + size - guard : mem, guard, PROT_NONE);
+  #else
+  guard = 0;
+  mem = (byte*)checked_malloc(size);
+  #endif
+  sepstack* s = (sepstack*)checked_malloc(sizeof(sepstack));
+  s->mem = mem;
+  s->memsize = size;
+  s->lo = (stackup ? mem : mem + guard);
+  s->hi = (stackup ? mem + size - guard : mem + size);
+  s->refcount = 0;
+  s->stackbase = NULL;
+  s->parent_top = NULL;
+  s->done = NULL;
+  s->res = lh_value_null;
+  s->owner = NULL;
+  s->next = __sepstacks;
+  __sepstacks = s;
+  #ifdef _STATS
+  stats.sepstack_allocated++;
+  #endif
+  // create the initial context on the new stack and run `sepstack_entry` to set the `start` entry
+  ucontext_t uc;
+  lh_jmp_buf creator;
+  if (getcontext(&uc) != 0) fatal(ENOTSUP, "cannot create a context for a separate stack");
+  uc.uc_stack.ss_sp = (void*)s->lo;
+  uc.uc_stack.ss_size = (size_t)(s->hi - s->lo);
+  uc.uc_link = NULL;
+  makecontext(&uc, &sepstack_entry, 0);
+  sepstack_launch.stack = s;
+  sepstack_launch.creator = &creator;
+  if (_lh_setjmp(creator) == 0) {
+    setcontext(&uc);
+  }
+  return sepstack_launch.stack;
+}
+
+static void sepstack_free(sepstack* s) {
+  assert(s->refcount == 0 && s->owner == NULL);
+  #ifdef HAS_MMAP
+  munmap(s->mem, s->memsize);
+  #else
+  checked_free(s->mem);
+  #endif
+  checked_free(s);
+}
+
+// Allocate a separate stack; unused stacks are reused.
+// Should not be called while running on a separate stack.
+static sepstack* sepstack_alloc(void) {
+  sepstack* found = NULL;
+  sepstack** prev = &__sepstacks;
+  while (*prev != NULL) {
+    sepstack* s = *prev;
+    if (s->refcount == 0 && found == NULL) {
+      found = s;
+      __sepstacks_unused--;
+    }
+    else if (s->refcount == 0 && __sepstacks_unused > SEPSTACK_POOLMAX) {
+      // free excess unused stacks
+      *prev = s->next;
+      __sepstacks_unused--;
+      sepstack_free(s);
+      continue;
+    }
+    prev = &s->next;
+  }
+  if (found == NULL) found = sepstack_new();
+  found->refcount = 1;
+  return found;
+}
+
+// Free all unused separate stacks of this thread.
+static void sepstack_free_unused(void) {
+  sepstack** prev = &__sepstacks;
+  while (*prev != NULL) {
+    sepstack* s = *prev;
+    if (s->refcount == 0) {
+      *prev = s->next;
+      __sepstacks_unused--;
+      sepstack_free(s);
+    }
+    else {
+      prev = &s->next;
+    }
+  }
+}
+
+static sepstack* sepstack_acquire(sepstack* s) {
+  assert(s->refcount > 0);
+  s->refcount++;
+  return s;
+}
+
+// Release a separate stack; it is kept for reuse once unused.
+// (we may still be running on it so it is only freed by a later `sepstack_alloc`)
+static void sepstack_release(sepstack* s) {
+  assert(s->refcount > 0);
+  if (--s->refcount == 0) {
+    assert(s->owner == NULL);
+    __sepstacks_unused++;
+  }
+}
+
+// Switch to the separate stack and run `action(arg)` on it.
+// Returns when the action returns (possibly through a resumption).
+static __noinline lh_value sepstack_run(sepstack* s, lh_actionfun* action, lh_value arg) {
+  lh_jmp_buf done;
+  s->done = &done;
+  s->parent_top = get_stack_top();
+  if (_lh_setjmp(done) != 0) {
+    // the action returned; note: this frame may have been restored as part of a bridge
+    return s->res;
+  }
+  sepstack_launch.stack = s;
+  sepstack_launch.action = action;
+  sepstack_launch.arg = arg;
+  _lh_longjmp(s->start, 1);
+}
+
+// Capture the frames on separate stack `s` from `top` in place for resumption `r`.
+static void sepstack_capture(sepstack* s, resume* r, const void* top) {
+  assert(s->owner == NULL);
+  ptrdiff_t size = stack_diff(top, s->stackbase);
+  r->sstack = s;
+  r->sepcstack.base = (stackup ? s->stackbase : top);
+  r->sepcstack.size = (size > 0 ? size : 0);
+  r->sepcstack.frames = NULL;
+  s->owner = r;
+  #ifdef _STATS
+  stats.sepstack_captured++;
+  #endif
+}
+
+// Copy the in-place frames of resumption `r` to the heap so its separate stack can be reused.
+static void sepstack_evict(resume* r) {
+  cstack* cs = &r->sepcstack;
+  assert(r->sstack->owner == r && cs->frames == NULL);
+  if (cs->size > 0) {
+    cs->frames = cstack_frames_alloc(cs->size);
+    memcpy(cs->frames, cs->base, cs->size);
+  }
+  r->sstack->owner = NULL;
+  #ifdef _STATS
+  stats.sepstack_copied++;
+  stats.sepstack_copied_size += cs->size;
+  #endif
+}
+
+// Ensure the frames of resumption `r` are in place on its separate stack before jumping to it.
+static void sepstack_restore(resume* r) {
+  sepstack* s = r->sstack;
+  if (s->owner == r) {
+    if (r->refcount > 1) {
+      sepstack_evict(r);  // it can be resumed again later; keep a copy
+    }
+    else {
+      s->owner = NULL;    // the frames are consumed by this resumption
+      #ifdef _STATS
+      stats.sepstack_resumed_inplace++;
+      #endif
+    }
+  }
+  else {
+    if (s->owner != NULL) sepstack_evict(s->owner);
+    if (r->sepcstack.frames != NULL) {
+      memcpy((void*)r->sepcstack.base, r->sepcstack.frames, r->sepcstack.size);
+    }
+  }
+}
+
+// Release the separate stack frames of a resumption
+static void sepstack_resume_free(resume* r) {
+  if (r->sstack == NULL) return;
+  if (r->sstack->owner == r) r->sstack->owner = NULL;
+  cstack_free(&r->sepcstack);
+  r->sstack = NULL;
+}
+
+#else
+
+static sepstack* sepstack_of(const void* p) {
+  (void)(p);
+  return NULL;
+}
+
+static bool stack_same(const void* p, const void* q) {
+  (void)(p); (void)(q);
+  return true;
+}
+
+static const void* sepstack_parent_top(const sepstack* s) {
+  (void)(s);
+  return NULL;
+}
+
+#endif
+
+
 /*-----------------------------------------------------------------
   Fragments
 -----------------------------------------------------------------*/
@@ -660,7 +1537,7 @@ static __noinline void fragment_free_(fragment* f) {
   f->eptr = NULL;
   #endif
   cstack_free(&f->cstack);
-  checked_free(f);
+  cstack_frames_free((byte*)f, sizeof(fragment));
 }
 
 static void _fragment_release(fragment* f) {
@@ -700,18 +1577,63 @@ static fragment* fragment_acquire(fragment* f) {
   Resumptions
 -----------------------------------------------------------------*/
 // Forward
-static void hstack_free(ref hstack* hs, bool do_release);
+static void resume_hstack_free(resume* r, bool do_release);
+
+// The resumption whose captured C stack was last restored on this thread; used as
+// the `image` for incremental captures (see `capture_cstack_delta`)
+static __thread resume* __cstack_image = NULL;
+
+// The total size of the captured C stacks of the resumptions captured on this thread
+// that are still alive; used to start compressing them (see `lh_set_resume_compact_threshold`)
+static __thread ptrdiff_t __resume_live_size = 0;
+
+// Is the captured C stack of `r` stored incrementally or compressed?
+static bool resume_cstack_encoded(const resume* r) {
+  return (r->image != NULL || r->compressed);
+}
+
+// The size of the stored C stack of `r`.
+static ptrdiff_t resume_cstack_stored(const resume* r) {
+  return (resume_cstack_encoded(r) ? r->encsize : r->cstack.size);
+}
+
+// Is `p` part of the allocated block of resumption `r`?
+static bool resume_block_contains(const resume* r, const void* p) {
+  return ((const byte*)p >= (const byte*)r && (const byte*)p < (const byte*)r + r->blocksize);
+}
+
+// Free the captured C stack and the block of a resumption
+static void resume_block_free(resume* r) {
+  assert(r->imagerefs == 0);
+  if (__cstack_image == r) __cstack_image = NULL;
+  __resume_live_size -= resume_cstack_stored(r);
+  if (r->image != NULL) {
+    resume* image = r->image;
+    cstack_frames_free(r->cstack.frames, r->encsize);
+    image->imagerefs--;
+    if (image->imagerefs == 0 && image->refcount == -1) resume_block_free(image);
+  }
+  else if (r->compressed) {
+    cstack_frames_free(r->cstack.frames, r->encsize);
+  }
+  else if (!resume_block_contains(r, r->cstack.frames)) {
+    cstack_free(&r->cstack);
+  }
+  cstack_frames_free((byte*)r, r->blocksize);
+}
 
 // release a resumptions; returns `true` if it was released
 static __noinline void _resume_free(resume* r) {
   assert(r->refcount == -1);
   #ifdef _STATS
   stats.rcont_released++;
-  stats.rcont_released_size += (long)r->cstack.size + (long)r->hstack.size;
+  stats.rcont_released_size += (long)resume_cstack_stored(r) + (long)r->hstack.size;
+  #endif
+  #ifdef _SEPSTACK
+  sepstack_resume_free(r);
   #endif
-  cstack_free(&r->cstack);
-  hstack_free(&r->hstack,true);
-  checked_free(r);
+  resume_hstack_free(r, true);
+  if (r->imagerefs == 0) resume_block_free(r);  // otherwise freed once no resumption shares our captured stack
 }
 
 static void _resume_release(resume* r) {
@@ -766,17 +1688,16 @@ static bool is_scopedhandler(const handler* h) {
 }
 
 
-#ifndef NDEBUG
 static bool is_effecthandler(const handler* h) {
   return (!is_skiphandler(h) && !is_fragmenthandler(h) && !is_scopedhandler(h));
 }
+
 static count handler_size(const lh_effect effect) {
   if (effect == LH_EFFECT(__skip)) return sizeof(skiphandler);
   else if (effect == LH_EFFECT(__fragment)) return sizeof(fragmenthandler);
   else if (effect == LH_EFFECT(__scoped)) return sizeof(scopedhandler);
   else return sizeof(effecthandler);
 }
-#endif
 
 // Return the handler below on the stack
 static handler* _handler_prev(const handler* h) {
@@ -784,11 +1705,13 @@ static handler* _handler_prev(const handler* h) {
   return (handler*)((byte*)h - h->prev);
 }
 
+#ifndef NDEBUG
 // Return a pointer to the last skipped handler 
 static handler* _handler_prev_skip(const skiphandler* sh) {
   assert(sh->toskip > 0);
   return (handler*)((byte*)sh - sh->toskip);
 }
+#endif
 
 static void handler_release(handler* h) {
   if (is_fragmenthandler(h)) {
@@ -803,15 +1726,36 @@ static void handler_release(handler* h) {
   else {
     assert(is_effecthandler(h));
     effecthandler* eh = (effecthandler*)h;
-    lh_releasefun* f = eh->hdef->local_release;
-    if (f != NULL) {
-      f(eh->local);
+    if ((eh->flags & HDEF_RELEASE) != 0) {
+      eh->hdef->local_release(eh->local);
     }
     eh->local = lh_value_null;
+    #ifdef _SEPSTACK
+    if (eh->sstack != NULL) {
+      sepstack_release(eh->sstack);
+      eh->sstack = NULL;
+    }
+    #endif
+  }
+}
+
+// Increase the reference count of the local state of an effect handler
+static void effecthandler_acquire_local(effecthandler* eh) {
+  if ((eh->flags & HDEF_ACQUIRE) != 0) {
+    eh->local = eh->hdef->local_acquire(eh->local);
   }
 }
 
 
+// Does copying the handler frame `h` need to acquire any of its fields?
+static bool handler_needs_acquire(const handler* h) {
+  if (is_fragmenthandler(h) || is_scopedhandler(h)) return true;
+  if (is_skiphandler(h)) return false;
+  assert(is_effecthandler(h));
+  const effecthandler* eh = (const effecthandler*)h;
+  return ((eh->flags & HDEF_ACQUIRE) != 0 || eh->sstack != NULL);
+}
+
 // Increase the reference count of handler fields
 static handler* handler_acquire(handler* h) {
   if (is_fragmenthandler(h)) {
@@ -826,15 +1770,259 @@ static handler* handler_acquire(handler* h) {
   else {
     assert(is_effecthandler(h));
     effecthandler* eh = (effecthandler*)h;
-    lh_acquirefun* f = eh->hdef->local_acquire;
-    if (f != NULL) {
-      eh->local = f(eh->local);
-    }
+    effecthandler_acquire_local(eh);
+    #ifdef _SEPSTACK
+    if (eh->sstack != NULL) sepstack_acquire(eh->sstack);
+    #endif
   }
   return h;
 }
 
 
+/*-----------------------------------------------------------------
+  Handler stack generations
+  Lookups of operations in the handler stack are cached (see
+  `hstack_find`) and stamped with the current generation of the
+  thread's handler stack. Pushing a frame starts a new generation which
+  invalidates all cached entries at once. Popping a frame keeps the
+  generation: the frames below are unchanged, and an entry for a popped
+  handler is detected as its offset is no longer below the top. The
+  exception are skip frames which hide handlers; popping those restores
+  the generation below if nothing was pushed meanwhile, or otherwise
+  starts a new one.
+  The inline cache of the header (see `lh_yield_inline`) holds direct
+  pointers into the frames and cannot check offsets; it uses its own
+  generation `_lh_fastgen` that also increments on every pop of an
+  effect handler or skip frame, and whenever the frames are reallocated.
+-----------------------------------------------------------------*/
+
+static __thread count hstack_gen = 0;      // current generation
+static __thread count hstack_lastgen = 0;  // last generation handed out
+
+__thread _lh_fastentry _lh_fastcache[_LH_FASTCACHE_SIZE];
+__thread ptrdiff_t     _lh_fastgen = 0;
+
+static count hstack_newgen() {
+  _lh_fastgen++;
+  hstack_gen = ++hstack_lastgen;
+  return hstack_gen;
+}
+
+// Called when a skip frame is popped
+static void hstack_pop_skipgen(const skiphandler* sh) {
+  if (hstack_gen == sh->gen) {
+    hstack_gen = sh->prevgen;   // the stack is as it was before pushing `sh`
+  }
+  else {
+    hstack_newgen();
+  }
+}
+
+
+/*-----------------------------------------------------------------
+  Effect identifiers and innermost handlers
+  Each thread assigns dense integer identifiers to effects the first
+  time it pushes a handler for them; these are found through an open
+  addressing hash table on the effect. Each effect handler in the
+  thread's handler stack records its identifier and links to the next
+  outer handler for the same effect (`prevsame`), while a per-thread
+  array maps each identifier to the offset of the innermost handler.
+  Skip frames hide a region of handlers and link to the next skip
+  frame below that region (`nextskip`). Together these let
+  `hstack_find` go directly to the handler of an effect, skipping
+  hidden regions as a whole, without visiting unrelated handlers.
+-----------------------------------------------------------------*/
+
+typedef struct _effectid {
+  lh_effect effect;
+  count     id;
+} effectid;
+
+static __thread ptrtable  effectids = PTRTABLE_EMPTY;  // of `effectid`; the count is also the next identifier
+static __thread count*    innermost = NULL;     // `innermost[id]` is the offset of the innermost handler (or -1)
+static __thread lh_effect* innermost_effects = NULL;  // `innermost_effects[id]` is the effect with identifier `id`
+static __thread count     innermost_size = 0;
+static __thread count     innermost_skip = -1;  // offset of the top most skip frame (or -1)
+
+// A skip region that is not (yet) pushed as a skip frame (see `tailskip_begin`).
+typedef struct _tailskip {
+  count toskip;    // the region hides the top `toskip` bytes of the handler stack (or none if 0)
+  count gen;       // the generation started by the region
+  count prevgen;   // the generation below the region
+} tailskip;
+
+static __thread tailskip hstack_tailskip = { 0, 0, 0 };
+
+// Return the identifier of an effect; assigns a new one if it did not have one yet.
+static count effect_id(lh_effect effect) {
+  bool added;
+  effectid* e = (effectid*)ptrtable_insert(&effectids, effect, sizeof(effectid), &added);
+  if (added) {
+    e->id = (count)effectids.count - 1;
+    if (e->id >= innermost_size) {
+      innermost_size = (innermost_size == 0 ? 32 : 2*innermost_size);
+      innermost = (count*)checked_realloc(innermost, innermost_size * sizeof(count));
+      innermost_effects = (lh_effect*)checked_realloc(innermost_effects, innermost_size * sizeof(lh_effect));
+    }
+    innermost[e->id] = -1;
+    innermost_effects[e->id] = effect;
+  }
+  return e->id;
+}
+
+/*-----------------------------------------------------------------
+  Handler definitions
+  The first time a thread pushes a handler for a definition, the
+  operation table is validated and summarized in a small table of
+  flags that is cached per thread (just like the effect identifiers).
+  As a definition may be freed and another one allocated at its
+  address, the cached analysis is redone if the definition differs.
+  Each effect handler frame keeps a copy of these flags so
+  the hot paths can branch on them without reading the definition.
+-----------------------------------------------------------------*/
+
+typedef struct _hdefinfo {
+  const lh_handlerdef* hdef;
+  lh_handlerdef        def;       // the definition as analyzed (as `hdef` may be freed and its address reused)
+  bool                 valid;     // `false` if the definition was invalid (and `fatal` returned)
+  count                effectid;  // the thread's identifier of the handled effect
+  unsigned             flags;     // HDEF_xxx flags
+} hdefinfo;
+
+static __thread ptrtable hdefinfos = PTRTABLE_EMPTY;  // of `hdefinfo`
+
+// Validate the operation table of `hdef` and summarize it in `info`.
+// An invalid definition is still summarized (in case `fatal` returns) but not cached.
+static void hdef_analyze(const lh_handlerdef* hdef, hdefinfo* info) {
+  lh_effect effect = hdef->effect;
+  info->hdef = hdef;
+  info->def = *hdef;
+  info->valid = false;
+  if (effect == NULL) {
+    fatal(EINVAL, "handler definition without an effect");
+    return;
+  }
+  bool valid = true;
+  unsigned kinds = 0;
+  const lh_operation* ops = hdef->operations;
+  if (ops != NULL) {
+    long i;
+    for (i = 0; ops[i].opkind != LH_OP_NULL; i++) {
+      const lh_operation* op = &ops[i];
+      if (effect[i+1] == NULL) {
+        fatal(EINVAL, "handler for '%s' defines more operations than its effect", lh_effect_name(effect));
+        valid = false;
+        break;
+      }
+      if (op->optag == NULL || op->optag->effect != effect || op->optag->opidx != i) {
+        fatal(EINVAL, "handler operation %li is not '%s' (operations must be in the same order as declared)", i, effect[i+1]);
+        valid = false;
+      }
+      if (op->opkind < LH_OP_FORWARD || op->opkind > LH_OP_GENERAL) {
+        fatal(EINVAL, "invalid operation kind for '%s'", effect[i+1]);
+        valid = false;
+        continue;
+      }
+      if (op->opfun == NULL && op->opkind != LH_OP_FORWARD) {
+        fatal(EINVAL, "no operation function for '%s' (only forwarding operations can have none)", effect[i+1]);
+        valid = false;
+      }
+      kinds |= HDEF_KIND(op->opkind);
+    }
+    if (valid && effect[i+1] != NULL) {
+      fatal(EINVAL, "handler for '%s' does not define operation '%s'", lh_effect_name(effect), effect[i+1]);
+      valid = false;
+    }
+  }
+  info->valid = valid;
+  info->effectid = effect_id(effect);
+  info->flags = kinds
+              | (valid && (kinds & ~HDEF_TAILKINDS) == 0 ? HDEF_TAILONLY : 0)
+              | (hdef->local_acquire != NULL ? HDEF_ACQUIRE : 0)
+              | (hdef->local_release != NULL ? HDEF_RELEASE : 0)
+              | (hdef->resultfun != NULL ? HDEF_RESULT : 0);
+}
+
+#ifdef __cplusplus
+// Operation tables may be modified at runtime (see test-yieldn) without changing the
+// definition itself; as a tail-only handler is installed without a jump point in C++, 
+// we rescan the (short) operation table of a cached tail-only definition on every use.
+static bool hdef_tailonly_changed(const hdefinfo* info, const lh_handlerdef* hdef) {
+  if ((info->flags & HDEF_TAILONLY) == 0) return false;
+  const lh_operation* op = hdef->operations;
+  if (op != NULL) {
+    for (; op->opkind != LH_OP_NULL; op++) {
+      if (op->opkind != LH_OP_FORWARD && op->opkind != LH_OP_TAIL_NOOP && op->opkind != LH_OP_TAIL) return true;
+    }
+  }
+  return false;
+}
+#endif
+
+// Return the analysis of a handler definition; analyzes it on first use in this thread.
+// The returned pointer is only valid until the next call.
+static const hdefinfo* hdef_info(const lh_handlerdef* hdef) {
+  bool added;
+  hdefinfo* info = (hdefinfo*)ptrtable_insert(&hdefinfos, hdef, sizeof(hdefinfo), &added);
+  if (added || !info->valid || memcmp(&info->def, hdef, sizeof(lh_handlerdef)) != 0
+    #ifdef __cplusplus
+    || hdef_tailonly_changed(info, hdef)
+    #endif
+     ) {
+    // first use, an invalid definition, a different definition at the address of one 
+    // that was freed, or a tail-only definition whose operations were changed
+    hdef_analyze(hdef, info);
+  }
+  return info;
+}
+
+// Validate and analyze a handler definition ahead of its first use.
+void lh_handlerdef_prepare(const lh_handlerdef* hdef) {
+  hdef_info(hdef);
+}
+
+// A handler frame at `offset` was pushed on, or moved onto, the thread's handler stack.
+static void innermost_push(hstack* hs, handler* h, count offset) {
+  if (is_skiphandler(h)) {
+    skiphandler* sh = (skiphandler*)h;
+    // skip frames in our hidden region are hidden themselves; the region of such
+    // frame is always contained in ours as the handler at `lo` was visible.
+    count lo = offset - sh->toskip;
+    count next = innermost_skip;
+    while (next >= lo) {
+      next = ((skiphandler*)(hs->hframes + next))->nextskip;
+    }
+    sh->prevskip = innermost_skip;
+    sh->nextskip = next;
+    innermost_skip = offset;
+  }
+  else if (is_effecthandler(h)) {
+    effecthandler* eh = (effecthandler*)h;
+    count id = eh->effectid;
+    if (id < 0 || id >= (count)effectids.count || innermost_effects[id] != h->effect) {
+      // the identifier was assigned by another thread, or before `lh_thread_done`
+      eh->effectid = hdef_info(eh->hdef)->effectid;
+    }
+    assert(eh->effectid == effect_id(h->effect));
+    eh->prevsame = innermost[eh->effectid];
+    innermost[eh->effectid] = offset;
+  }
+}
+
+// A handler frame is popped from the thread's handler stack.
+static void innermost_pop(const handler* h) {
+  if (is_skiphandler(h)) {
+    innermost_skip = ((const skiphandler*)h)->prevskip;
+    _lh_fastgen++;
+  }
+  else if (is_effecthandler(h)) {
+    const effecthandler* eh = (const effecthandler*)h;
+    innermost[eh->effectid] = eh->prevsame;
+    _lh_fastgen++;
+  }
+}
+
+
 /*-----------------------------------------------------------------
   Handler stacks
 -----------------------------------------------------------------*/
@@ -843,6 +2031,12 @@ static handler* handler_acquire(handler* h) {
 #define HMINSIZE     (32*sizeof(effecthandler))
 #define HMAXEXPAND   (2*1024*1024)
 
+// The handler stack of a thread that grew beyond `hstack_shrink_minsize` bytes is shrunk 
+// again once less than a quarter is in use, but never below the `hstack_reserved` bytes.
+// Growing at full, and shrinking to half at a quarter, prevents repeated reallocation.
+static size_t hstack_shrink_minsize = 256*1024;
+static __thread size_t hstack_reserved = 0;
+
 static count hstack_goodsize(count needed) {
   if (needed > HMAXEXPAND) {
     return (HMAXEXPAND * ((needed + HMAXEXPAND - 1) / HMAXEXPAND)); // round up to next HMAXEXPAND
@@ -856,6 +2050,8 @@ static count hstack_goodsize(count needed) {
 
 // forward
 static handler* hstack_at(const hstack* hs, count  idx);
+static void tailskip_push(hstack* hs);
+static void tailskip_cancel();
 
 // Initialize a handler stack
 static void hstack_init(hstack* hs) {
@@ -863,6 +2059,7 @@ static void hstack_init(hstack* hs) {
   hs->size = 0;
   hs->hframes = NULL;
   hs->top = hstack_at(hs, 0);
+  hstack_newgen();
 }
 
 
@@ -925,6 +2122,7 @@ static void hstack_realloc_(ref hstack* hs, count needed) {
   hs->hframes = (byte*)checked_realloc(hs->hframes, newsize);
   hs->size = newsize;
   hs->top = hstack_at(hs, topsize);
+  _lh_fastgen++;  // the frames moved (offsets stay valid for `hstack_find`)
   #ifdef _STATS
   if (newsize > stats.hstack_max) stats.hstack_max = newsize;
   #endif
@@ -938,6 +2136,7 @@ static handler* hstack_prev(hstack* hs, handler* h) {
   return (prev==h ? NULL : prev);
 }
 
+#ifndef NDEBUG
 // Return the bottomost skipped handler
 static handler* hstack_prev_skip(hstack* hs, skiphandler* h) {
   assert(valid_handler(hs, to_handler(h)));
@@ -945,19 +2144,25 @@ static handler* hstack_prev_skip(hstack* hs, skiphandler* h) {
   assert(valid_handler(hs, prev));
   return prev;
 }
+#endif
+
+// Release all handler frames in an `hstack`
+static void hstack_release_frames(hstack* hs) {
+  if (!hstack_empty(hs)) {
+    handler* h = hstack_top(hs);
+    do {
+      handler_release(h);
+      h = hstack_prev(hs, h);
+    } 
+    while (h != NULL);
+  }
+}
 
 // Release the handler frames of an `hstack`
 static void hstack_free(ref hstack* hs, bool do_release) {
   assert(hs != NULL);
   if (hs->hframes != NULL) {
-    if (do_release && !hstack_empty(hs)) {
-      handler* h = hstack_top(hs);
-      do {
-        handler_release(h);
-        h = hstack_prev(hs, h);
-      } 
-      while (h != NULL);
-    }
+    if (do_release) hstack_release_frames(hs);
     checked_free(hs->hframes);
     hstack_init(hs);
   }
@@ -974,6 +2179,11 @@ static void hstack_free(ref hstack* hs, bool do_release) {
 static void hstack_pop(ref hstack* hs, bool do_release) {
   assert(!hstack_empty(hs));
   if (do_release) { handler_release(hstack_top(hs)); }
+  if (is_skiphandler(hs->top)) { hstack_pop_skipgen((skiphandler*)hs->top); }
+  if (hs == &__hstack) { 
+    if (hstack_tailskip.toskip > 0) tailskip_cancel();
+    innermost_pop(hs->top); 
+  }
   hs->count = ptrdiff(hs->top, hs->hframes);
   hs->top = _handler_prev(hs->top);
 }
@@ -998,6 +2208,16 @@ static handler* hstack_ensure_space(ref hstack* hs, count extracount) {
   if (needed > hs->size) {
     hstack_realloc_(hs, needed);
   }
+  else if (needed < hs->size/4 && (size_t)hs->size > hstack_shrink_minsize && hs == &__hstack) {
+    // only the thread's handler stack, as the frames of a resumption are part of its block
+    count shrunk = hstack_goodsize((size_t)(2*needed) > hstack_reserved ? 2*needed : (count)hstack_reserved);
+    if (shrunk < hs->size) {
+      hstack_realloc_(hs, shrunk);
+      #ifdef _STATS
+      stats.hstack_shrunk++;
+      #endif
+    }
+  }
   return hstack_at(hs, 0);
 }
 
@@ -1005,38 +2225,152 @@ static handler* hstack_ensure_space(ref hstack* hs, count extracount) {
 // Push a new uninitialized handler frame and return a reference to it.
 static handler* _hstack_push(ref hstack* hs, lh_effect effect, count size) {
   assert(size == handler_size(effect));
+  if (hstack_tailskip.toskip > 0 && hs == &__hstack) tailskip_push(hs);
   handler* h = hstack_ensure_space(hs, size);
   h->effect = effect;
   h->prev = ptrdiff(h, hs->top);
   assert((hs->count > 0 && h->prev > 0) || (hs->count == 0 && h->prev == 0));
   hs->top = h;
   hs->count += size;
+  hstack_newgen();
   return h;
 }
 
+// Handler identifiers are unique over all threads without sharing a counter: 
+// each thread takes a range of identifiers at a time, using the next range index
+// in the high 32 bits and counting in the low 32 bits. Identifiers are unsigned 
+// 64-bit on every platform so neither part can overflow into the other.
+#define HANDLER_ID_BITS  (32)
+
+static volatile uint32_t handler_ranges = 0;    // the last range index handed out
+static __thread handlerid handler_nextid = 0;   // the next identifier in our range (or 0 if none)
+
+static handlerid handler_newid() {
+  handlerid id = handler_nextid;
+  if ((uint32_t)id == 0) {
+    // take a new range on first use or when ours is exhausted (and never use an identifier of 0)
+    const uint32_t range = (uint32_t)lh_atomic_increment(&handler_ranges);
+    id = ((handlerid)range << HANDLER_ID_BITS) + 1;
+  }
+  handler_nextid = id + 1;
+  return id;
+}
+
 // Push an effect handler
 static effecthandler* hstack_push_effect(ref hstack* hs, const lh_handlerdef* hdef, void* stackbase, lh_value local)
 {
-  static count id = 1000;
+  const hdefinfo* info = hdef_info(hdef);
   effecthandler* h = (effecthandler*)_hstack_push(hs, hdef->effect, sizeof(effecthandler));
-  h->id = id++;
+  h->id = handler_newid();
   h->hdef = hdef;
+  h->effectid = info->effectid;
+  h->flags = info->flags;
   h->stackbase = stackbase;
   h->local = local;
   h->exn_frame = NULL;
+  h->sstack = NULL;
   h->arg = lh_value_null;
   h->arg_op = NULL;
   h->arg_resume = NULL;
+  h->arg_fixed.argcount = 0;
+  assert(hs == &__hstack);
+  innermost_push(hs, to_handler(h), ptrdiff(h, hs->hframes));
   return h;
 }
 
 // Push a skip handler
 static skiphandler* hstack_push_skip(ref hstack* hs, count toskip) {
+  count prevgen = hstack_gen;
   skiphandler* h = (skiphandler*)_hstack_push(hs, LH_EFFECT(__skip), sizeof(skiphandler));
   h->toskip = toskip;
+  h->gen = hstack_gen;
+  h->prevgen = prevgen;
+  assert(hs == &__hstack);
+  innermost_push(hs, to_handler(h), ptrdiff(h, hs->hframes));
   return h;
 }
 
+
+/*-----------------------------------------------------------------
+  Pending skip regions
+  While a tail resumptive operation function runs, the handlers from
+  its own handler up to the top are hidden. Instead of pushing a skip
+  frame for every call, `yieldop` sets a per-thread pending region that
+  `hstack_find` takes into account. Only when a frame is pushed, or the
+  handler stack captured, while the region is pending, it becomes a real
+  skip frame; as nothing was pushed or popped since, the top is still
+  where the region starts. A pop while a region is pending only happens
+  when unwinding out of the operation function and ends the region.
+  Regions nest: the region of an operation yielded from an operation
+  function contains the region of the outer one, which is restored
+  afterwards.
+-----------------------------------------------------------------*/
+
+// Hide the top `toskip` bytes of the handler stack; returns the previous pending region.
+static tailskip tailskip_begin(count toskip) {
+  tailskip saved = hstack_tailskip;
+  hstack_tailskip.toskip = toskip;
+  hstack_tailskip.prevgen = hstack_gen;
+  hstack_tailskip.gen = hstack_newgen();
+  return saved;
+}
+
+// Push the pending region as a skip frame.
+static void tailskip_push(hstack* hs) {
+  assert(hs == &__hstack && hstack_tailskip.toskip > 0 && hstack_gen == hstack_tailskip.gen);
+  tailskip ts = hstack_tailskip;
+  hstack_tailskip.toskip = 0;
+  skiphandler* sh = hstack_push_skip(hs, ts.toskip);
+  sh->prevgen = ts.prevgen;   // popping it restores the generation below the region
+}
+
+// A frame is popped while a region is pending.
+static void tailskip_cancel() {
+  hstack_tailskip.toskip = 0;
+  hstack_newgen();
+}
+
+// End the region of an operation function that returned, and reinstate the `saved` region.
+static void tailskip_end(hstack* hs, const tailskip* saved) {
+  if (hstack_tailskip.toskip > 0) {
+    if (hstack_gen == hstack_tailskip.gen) {
+      hstack_gen = hstack_tailskip.prevgen;  // the stack is as it was before the region
+      _lh_fastgen++;
+    }
+    else {
+      hstack_newgen();
+    }
+  }
+  else {
+    // it was pushed as a skip frame
+    assert(!hstack_empty(hs) && is_skiphandler(hstack_top(hs)));
+    hstack_pop(hs, false);  // skip frames need no release
+  }
+  hstack_tailskip = *saved;
+  if (saved->toskip > 0 && hstack_gen != saved->gen) {
+    // a new generation started since (as the handler stack was moved): never restore the saved one
+    hstack_tailskip.prevgen = hstack_gen;
+    hstack_tailskip.gen = hstack_newgen();
+  }
+}
+
+#ifdef __cplusplus
+// Ends a pending region even when exceptions are raised.
+class raii_tailskip_end {
+private:
+  hstack*         hs;
+  const tailskip* saved;
+public:
+  raii_tailskip_end(hstack* hs, const tailskip* saved) {
+    this->hs = hs;
+    this->saved = saved;
+  }
+  ~raii_tailskip_end() {
+    tailskip_end(hs, saved);
+  }
+};
+#endif
+
 // Push a fragment handler
 static fragmenthandler* hstack_push_fragment(ref hstack* hs, fragment* fragment) {
   fragmenthandler* h = (fragmenthandler*)_hstack_push(hs, LH_EFFECT(__fragment), sizeof(fragmenthandler));
@@ -1056,35 +2390,57 @@ static scopedhandler* hstack_push_scoped(ref hstack* hs, resume* resume) {
 // Include `from` in the moved handlers. Returns a pointer to the new `from` in `hs`.
 static handler* hstack_append_movefrom(ref hstack* hs, ref hstack* topush, const handler* from) {
   assert(hstack_contains(topush, from));
+  if (hstack_tailskip.toskip > 0 && hs == &__hstack) tailskip_push(hs);
   count  needed = hstack_indexof(topush, from);
   handler* bot = hstack_ensure_space(hs, needed);
   memcpy(bot, from, needed);
   bot->prev = hstack_topsize(hs);
   hs->count += needed;
   hs->top = hstack_at(hs,hstack_topsize(topush));
+  hstack_newgen();  // also ensures the generations saved in the moved skip frames are never restored
+  if (hs == &__hstack) {
+    // relink the moved handlers from the bottom up
+    for (handler* h = bot; h <= hs->top; h = (handler*)((byte*)h + handler_size(h->effect))) {
+      innermost_push(hs, h, ptrdiff(h, hs->hframes));
+    }
+  }
   return bot;
 }
 
+// Acquire the handlers above `bot` after they were copied; returns `false` if none needed it.
+static bool hstack_acquire_above(ref hstack* hs, handler* bot) {
+  bool acquired = false;
+  handler* h = hstack_top(hs);
+  while(h > bot) {
+    if (handler_needs_acquire(h)) {
+      handler_acquire(h);
+      acquired = true;
+    }
+    h = hstack_prev(hs,h);
+  } 
+  assert(h==bot);
+  return acquired;
+}
+
 // Copy handlers from one stack to another increasing reference counts as appropiate.
 // Include `from` in the copied handlers but will not acquire it!!
 // Returns a pointer to the new `from` in `hs`.
 static handler* hstack_append_copyfrom(ref hstack* hs, ref hstack* tocopy, handler* from ) {
   assert(hstack_contains(tocopy,from));
   handler* bot = hstack_append_movefrom(hs, tocopy, from);
-  handler* h = hstack_top(hs);
-  while(h > bot) {
-    handler_acquire(h);    
-    h = hstack_prev(hs,h);
-  } 
-  assert(h==bot);
+  hstack_acquire_above(hs, bot);
   return bot;
 }
 
-// Find an operation that handles `optag` in the handler stack.
-static effecthandler* hstack_find(ref hstack* hs, lh_optag optag, out const lh_operation** op, out count* skipped) {
+#ifndef NDEBUG
+// Find an operation that handles `optag` by walking down the handler stack (to check `hstack_find`).
+static effecthandler* hstack_find_walk(ref hstack* hs, lh_optag optag, out const lh_operation** op, out count* skipped) {
   if (!hstack_empty(hs)) {
     handler* h = hstack_top(hs);
-    do {
+    if (hstack_tailskip.toskip > 0) {
+      h = hstack_prev(hs, hstack_at(hs, hstack_tailskip.toskip));  // below the pending skip region
+    }
+    while (h != NULL) {
       assert(valid_handler(hs, h));
       if (h->effect == optag->effect) {
         effecthandler* eh = (effecthandler*)h;
@@ -1102,7 +2458,44 @@ static effecthandler* hstack_find(ref hstack* hs, lh_optag optag, out const lh_o
         h = hstack_prev_skip(hs,(skiphandler*)h);
       }
       h = hstack_prev(hs, h);
-    } while (h != NULL);
+    }
+  }
+  fatal(ENOSYS, "no handler for operation found: '%s'", lh_optag_name(optag));
+  *skipped = 0;
+  *op = NULL;
+  return NULL;
+}
+#endif
+
+// Find an operation that handles `optag` by following the links between the handlers of its effect.
+static effecthandler* hstack_find_innermost(ref hstack* hs, lh_optag optag, out const lh_operation** op, out count* skipped) {
+  assert(hs == &__hstack);
+  count offset = innermost[effect_id(optag->effect)];
+  count skip = innermost_skip;  // the skip frame that determines if `offset` is visible
+  if (hstack_tailskip.toskip > 0) {
+    const count lo = hs->count - hstack_tailskip.toskip;
+    while (offset >= lo) {
+      offset = ((effecthandler*)(hs->hframes + offset))->prevsame;  // hidden by the pending skip region
+    }
+  }
+  while (offset >= 0) {
+    effecthandler* eh = (effecthandler*)(hs->hframes + offset);
+    assert(valid_handler(hs, to_handler(eh)) && to_handler(eh)->effect == optag->effect);
+    const skiphandler* sh;
+    while (skip >= 0 && offset < skip - (sh = (const skiphandler*)(hs->hframes + skip))->toskip) {
+      skip = sh->nextskip;   // below the region skipped by `sh`
+    }
+    if (skip < 0 || offset > skip) {  // not hidden
+      const lh_operation* oper = &eh->hdef->operations[optag->opidx];
+      assert(oper->optag == optag); // can fail if operations are defined in a different order than declared
+      assert(oper->opfun != NULL || oper->opkind == LH_OP_FORWARD);
+      if (oper->opfun != NULL) {    // NULL functions are assume tail-resumptive identity functions, skip it
+        *skipped = hs->count - offset; assert(*skipped > 0);
+        *op = oper;
+        return eh;
+      }
+    }
+    offset = eh->prevsame;
   }
   fatal(ENOSYS, "no handler for operation found: '%s'", lh_optag_name(optag));
   *skipped = 0;
@@ -1110,6 +2503,65 @@ static effecthandler* hstack_find(ref hstack* hs, lh_optag optag, out const lh_o
   return NULL;
 }
 
+// Each thread caches the last handler found for an `optag` in a small direct mapped table.
+#define FINDCACHE_SIZE  (64)   // must be a power of 2
+
+typedef struct _findentry {
+  lh_optag            optag;
+  count               gen;      // the handler stack generation in which the handler was found
+  count               offset;   // the offset of the handler in the `hframes`
+  const lh_operation* op;
+} findentry;
+
+static __thread findentry findcache[FINDCACHE_SIZE];
+
+static findentry* findcache_entry(lh_optag optag) {
+  // optags are static structures of at least two words
+  return &findcache[((uintptr_t)optag / (2*sizeof(void*))) % FINDCACHE_SIZE];
+}
+
+// Remember a found handler in the inline cache of the header (see `lh_yield_inline`).
+static void fastcache_update(lh_optag optag, effecthandler* eh, const lh_operation* op) {
+  _lh_fastentry* f = _lh_fastcache_entry(optag);
+  f->optag = optag;
+  f->gen = _lh_fastgen;
+  f->local = &eh->local;
+  f->opfun = (op->opkind == LH_OP_TAIL_NOOP ? op->opfun : NULL);
+}
+
+// Find an operation that handles `optag` in the thread's handler stack.
+static effecthandler* hstack_find(ref hstack* hs, lh_optag optag, out const lh_operation** op, out count* skipped) {
+  assert(hs == &__hstack);
+  findentry* e = findcache_entry(optag);
+  if (e->optag == optag && e->gen == hstack_gen && e->offset < hs->count) {
+    effecthandler* eh = (effecthandler*)(hs->hframes + e->offset);
+    #ifndef NDEBUG
+    const lh_operation* wop;
+    count wskipped;
+    assert(hstack_find_walk(hs, optag, &wop, &wskipped) == eh && wop == e->op);
+    #endif
+    #ifdef _DEBUG_STATS
+    stats.operations_cached++;
+    #endif
+    *skipped = hs->count - e->offset;
+    *op = e->op;
+    fastcache_update(optag, eh, e->op);
+    return eh;
+  }
+  effecthandler* eh = hstack_find_innermost(hs, optag, op, skipped);
+  #ifndef NDEBUG
+  const lh_operation* wop;
+  count wskipped;
+  assert(hstack_find_walk(hs, optag, &wop, &wskipped) == eh && wop == *op);
+  #endif
+  e->optag = optag;
+  e->gen = hstack_gen;
+  e->offset = ptrdiff(eh, hs->hframes);
+  e->op = *op;
+  fastcache_update(optag, eh, *op);
+  return eh;
+}
+
 
 
 
@@ -1122,78 +2574,84 @@ static effecthandler* hstack_find(ref hstack* hs, lh_optag optag, out const lh_o
   the unwinding returns a `cstack` object that should be restored when
   possible. 
 
-  Todo:  we could optimize more by first scanning the maximum
-  stack we need and allocate only once; now we reallocate on every
-  newly extending fragment. In practice though it is rare to encounter
-  more than one fragment so this may not be worth it.
+  When unwinding through multiple fragments (e.g. for resumptions that
+  are resumed within other resumptions), we first scan the fragments to
+  determine the extent of all the stacks to restore, and then allocate
+  the restore buffer only once.
 -----------------------------------------------------------------*/
 const byte* _min(const byte* p, const byte* q) { return (p <= q ? p : q); }
 const byte* _max(const byte* p, const byte* q) { return (p >= q ? p : q); }
 
-// Extend cstack `cs` in-place to encompass both the `ds` stack and itself.
-static void cstack_extendfrom(ref cstack* cs, ref cstack* ds, bool will_free_ds) {
-  const byte* csb = cstack_base(cs);
+// Return the fragment of handler `h` if it has a stack that needs to be restored 
+// when unwinding to `target`; returns `NULL` otherwise.
+static fragment* fragment_to_restore(handler* h, const void* target) {
+  if (!is_fragmenthandler(h)) return NULL;
+  fragment* f = ((fragmenthandler*)h)->fragment;
+  if (f->cstack.frames == NULL || !stack_same(f->cstack.base, target)) return NULL;
+  return f;
+}
+
+// Copy the frames of `ds` into `cs` which is already large enough to encompass it.
+// `covered_lo` and `covered_hi` delimit the part of `cs` that was copied into before;
+// if `ds` does not overlap with it, the gap in between is copied from the current stack.
+static void cstack_copyfrom(ref cstack* cs, const cstack* ds, ref const byte** covered_lo, ref const byte** covered_hi) {
   const byte* dsb = cstack_base(ds);
-  if (cs->frames == NULL) {
-    // nothing yet, just copy `ds`
-    if (ds->frames != NULL) {
-      if (will_free_ds) {
-        // `ds` is about to be freed.. take over its frames
-        *cs = *ds; // copy fields
-        // and prevent freeing `ds`
-        ds->frames = NULL;
-        ds->size = 0;
-      }
-      else {
-        // otherwise copy the c-stack from ds
-        cs->frames = (byte*)checked_malloc(ds->size);
-        memcpy(cs->frames, ds->frames, ds->size);
-        cs->base = ds->base;
-        cs->size = ds->size;
-      }
-    }
+  const byte* dse = dsb + ds->size;
+  const byte* csb = cstack_base(cs);
+  assert(dsb >= csb && dse <= csb + cs->size);
+  if (*covered_lo == NULL) {
+    *covered_lo = dsb;
+    *covered_hi = dse;
   }
   else {
-    // otherwise extend such that we can merge `cs` and `ds` together
-    const byte* newbase = _min(csb,dsb);
-    ptrdiff_t   newsize = _max(csb + cs->size, dsb + ds->size) - newbase;
-    // check if we need to reallocate; no need if `ds` fits right in.
-    if (csb != newbase || cs->size != newsize) {
-      // reallocate..
-      byte* newframes = (byte*)checked_malloc(newsize);
-      // if non-overlapping, copy the current stack first into the gap
-      // (there is never a gap at the ends as `cs` or `ds` either start or end the `newframes`).
-      if ((dsb > csb + cs->size) || (dsb + ds->size < csb)) {
-        // todo: we could optimize this further by just copying the gap part
-        memcpy(newframes, newbase, newsize);
-      }
-      // next copy the cs->frames into the new frames
-      assert(csb >= newbase);
-      assert(csb + cs->size <= newbase + newsize);
-      memcpy(newframes + (csb - newbase), cs->frames, cs->size);
-      // and update cs
-      checked_free(cs->frames);
-      cs->frames = newframes;
-      cs->size = newsize;
-      cs->base = newbase;
+    // (there is never a gap at the ends as the restored stacks are exactly encompassed by `cs`).
+    if (dsb > *covered_hi) {
+      memcpy(cs->frames + (*covered_hi - csb), *covered_hi, dsb - *covered_hi);
     }
-    // and finally copy the new `ds->frames` into `cs` (which is now large enought to contain `ds`)
-    assert(cs->base == newbase);
-    assert(cs->size == newsize);
-    assert(dsb >= newbase);
-    assert(dsb + ds->size <= newbase + newsize);
-    memcpy(cs->frames + (dsb - newbase), ds->frames, ds->size);    
+    else if (dse < *covered_lo) {
+      memcpy(cs->frames + (dse - csb), dse, *covered_lo - dse);
+    }
+    *covered_lo = _min(*covered_lo, dsb);
+    *covered_hi = _max(*covered_hi, dse);
   }
+  memcpy(cs->frames + (dsb - csb), ds->frames, ds->size);
 }
 
 
 // Pop the stack up to the given handler `h` (which should reside in `hs`)
 // Return a stack object in `cs` (if not `NULL) that should be restored later on.
-static void hstack_pop_upto(ref hstack* hs, ref handler* h, bool do_release, out cstack* cs) 
+// Only fragments on the same C stack as `target` are restored.
+static void hstack_pop_upto(ref hstack* hs, ref handler* h, bool do_release, const void* target, out cstack* cs) 
 {
   if (cs != NULL) cstack_init(cs);
   assert(!hstack_empty(hs));
-  handler* cur = hstack_top(hs);
+  // first determine the extent of the stacks to restore
+  handler*    cur;
+  fragment*   f;
+  count       fragments = 0;
+  const byte* lo = NULL;
+  const byte* hi = NULL;
+  if (cs != NULL) {
+    for (cur = hstack_top(hs); cur > h; cur = _handler_prev(cur)) {
+      f = fragment_to_restore(cur, target);
+      if (f != NULL) {
+        const byte* fb = cstack_base(&f->cstack);
+        lo = (fragments == 0 ? fb : _min(lo, fb));
+        hi = (fragments == 0 ? fb + f->cstack.size : _max(hi, fb + f->cstack.size));
+        fragments++;
+      }
+    }
+    if (fragments > 1) {
+      // allocate once for all stacks to restore
+      cs->base = lo;
+      cs->size = hi - lo;
+      cs->frames = cstack_frames_alloc(cs->size);
+    }
+  }
+  // and pop while copying the stacks to restore
+  const byte* covered_lo = NULL;
+  const byte* covered_hi = NULL;
+  cur = hstack_top(hs);
 //  handler* skip_upto = NULL;
   while( cur > h ) {
     /*
@@ -1203,11 +2661,24 @@ static void hstack_pop_upto(ref hstack* hs, ref handler* h, bool do_release, out
     }
     else {
     */
-      if (is_fragmenthandler(cur)) {
+      if (fragments > 0 && (f = fragment_to_restore(cur, target)) != NULL) {
         // special "fragment" handler; remember to restore the stack
-        fragment* f = ((fragmenthandler*)cur)->fragment;
-        if (f->cstack.frames != NULL) {
-          cstack_extendfrom(cs, &f->cstack, do_release && f->refcount == 1);
+        if (fragments > 1) {
+          cstack_copyfrom(cs, &f->cstack, &covered_lo, &covered_hi);
+        }
+        else if (do_release && f->refcount == 1) {
+          // the only fragment and it is about to be freed.. take over its frames
+          *cs = f->cstack; // copy fields
+          // and prevent freeing them
+          f->cstack.frames = NULL;
+          f->cstack.size = 0;
+        }
+        else {
+          // otherwise copy the c-stack from the fragment
+          cs->frames = cstack_frames_alloc(f->cstack.size);
+          memcpy(cs->frames, f->cstack.frames, f->cstack.size);
+          cs->base = f->cstack.base;
+          cs->size = f->cstack.size;
         }
       }
     /*
@@ -1232,6 +2703,7 @@ static void hstack_pop_upto(ref hstack* hs, ref handler* h, bool do_release, out
 
 static bool initialized = false;
 static struct exn_frame* exn_bottom = NULL;
+static __thread bool hstack_persistent = false;   // set by `lh_thread_init`
 
 static __noinline bool _lh_init(hstack* hs) {
   if (!initialized) {
@@ -1252,13 +2724,147 @@ static __noinline bool _lh_init(hstack* hs) {
 }
 
 static bool lh_init(hstack* hs) {
-  if (hs->size!=0) return false;
-              else return _lh_init(hs);
+  if (hs->size!=0) {
+    if (hs->count==0) stackbottom = get_stack_top(); // outermost handler on a persistent hstack
+    return false;
+  }
+  else return _lh_init(hs);
+}
+
+// Free the pools and tables of this thread (see `thread_exit`).
+static void thread_free_tables() {
+  if (promoted_spare != NULL) {
+    cstack_frames_free((byte*)promoted_spare, promoted_spare->blocksize);
+    promoted_spare = NULL;
+  }
+  cstack_pool_trim(0);
+  #ifdef _SEPSTACK
+  sepstack_free_unused();
+  #endif
+  ptrtable_free(&effectids);
+  ptrtable_free(&hdefinfos);
+  ptrtable_free(&promotes);
+  if (innermost != NULL) checked_free(innermost);
+  if (innermost_effects != NULL) checked_free(innermost_effects);
+  innermost = NULL;
+  innermost_effects = NULL;
+  innermost_size = 0;
+}
+
+/*-----------------------------------------------------------------
+  Thread exit
+  The pools and tables of a thread (captured stacks, effect identifiers,
+  handler definitions, and promoted operations) are caches that should
+  survive from one outermost handler to the next. They are freed when 
+  the thread exits, through a destructor of a pthread key (or a fiber
+  local storage callback on Windows) that is registered once per thread.
+  Without such support they are freed whenever the outermost handler
+  returns instead.
+-----------------------------------------------------------------*/
+#ifdef _THREAD_EXIT
+static __thread bool thread_exit_registered = false;
+
+// The thread exits: free its handler stack (if it is not in use) and its pools and tables.
+static void thread_exit() {
+  thread_exit_registered = false;  // register again if it is used in a later destructor
+  hstack* hs = &__hstack;
+  if (hs->size > 0 && hs->count == 0) {
+    hstack_persistent = false;
+    hstack_reserved = 0;
+    hstack_free(hs,true);
+  }
+  thread_free_tables();
+}
+
+#ifdef _WIN32
+static DWORD     thread_exit_key = FLS_OUT_OF_INDEXES;
+static INIT_ONCE thread_exit_once = INIT_ONCE_STATIC_INIT;
+
+static void WINAPI thread_exit_callback(void* value) {
+  if (value != NULL) thread_exit();
+}
+
+static BOOL CALLBACK thread_exit_key_create(PINIT_ONCE once, void* param, void** context) {
+  thread_exit_key = FlsAlloc(&thread_exit_callback);
+  return TRUE;
+}
+
+static bool thread_exit_key_set() {
+  InitOnceExecuteOnce(&thread_exit_once, &thread_exit_key_create, NULL, NULL);
+  return (thread_exit_key != FLS_OUT_OF_INDEXES && FlsSetValue(thread_exit_key, (void*)1));
+}
+#else
+static pthread_key_t  thread_exit_key;
+static bool           thread_exit_key_valid = false;
+static pthread_once_t thread_exit_once = PTHREAD_ONCE_INIT;
+
+static void thread_exit_callback(void* value) {
+  if (value != NULL) thread_exit();
+}
+
+static void thread_exit_key_create() {
+  thread_exit_key_valid = (pthread_key_create(&thread_exit_key, &thread_exit_callback) == 0);
+}
+
+static bool thread_exit_key_set() {
+  pthread_once(&thread_exit_once, &thread_exit_key_create);
+  return (thread_exit_key_valid && pthread_setspecific(thread_exit_key, (void*)1) == 0);
+}
+#endif
+#endif
+
+// Ensure the pools and tables of this thread are freed when it exits; 
+// returns `false` if that is not supported (or failed).
+static bool thread_exit_register() {
+  #ifdef _THREAD_EXIT
+  if (!thread_exit_registered) thread_exit_registered = thread_exit_key_set();
+  return thread_exit_registered;
+  #else
+  return false;
+  #endif
 }
 
 static __noinline void lh_done(hstack* hs) {
   assert(hs == &__hstack && hs->size>0 && hs->count==0 && (byte*)hs->top==&hs->hframes[0]);
+  if (!hstack_persistent) {
+    hstack_free(hs,true);
+    // keep the pools and tables for the next outermost handler unless they cannot be freed on thread exit
+    if (!thread_exit_register()) thread_free_tables();
+  }
+}
+
+// Keep the handler stack of this thread alive across outermost handlers.
+void lh_thread_init() {
+  hstack* hs = &__hstack;
+  if (hs->size==0) {
+    _lh_init(hs);
+    hstack_realloc_(hs, (hstack_reserved > HMINSIZE ? (count)hstack_reserved : (count)HMINSIZE));
+  }
+  hstack_persistent = true;
+  thread_exit_register();
+}
+
+// Reserve room in the handler stack of this thread.
+void lh_hstack_reserve(size_t bytes) {
+  lh_thread_init();
+  hstack_reserved = bytes;
+  hstack* hs = &__hstack;
+  if ((size_t)hs->size < bytes) hstack_realloc_(hs, (count)bytes);
+}
+
+// Set the size above which a handler stack is shrunk again.
+void lh_set_hstack_shrink(size_t minsize) {
+  hstack_shrink_minsize = minsize;
+}
+
+// Free the handler stack and the pools of this thread.
+void lh_thread_done() {
+  hstack* hs = &__hstack;
+  if (hs->count > 0) fatal(EINVAL, "lh_thread_done called while handlers are still active");
+  hstack_persistent = false;
+  hstack_reserved = 0;
   hstack_free(hs,true);
+  thread_free_tables();
 }
 
 #ifdef __cplusplus
@@ -1292,19 +2898,28 @@ public:
   Internal: Jump to a context
 -----------------------------------------------------------------*/
 
+// Forward
+static void resume_cstack_decode(const resume* r, byte* dst);
+
 // `_jumpto_stack` jumps to a given entry with a given c-stack to restore.
 // It is called from `jumpto` which ensures through an `alloca` that it will
 // run in a stack frame just above the stack we are restoring (so the local 
 // variables will remain in-tact. The `no_opt` parameter is there so 
 // smart compilers (i.e. clang) will not optimize away the `alloca` in `jumpto`.
+// If `encoded` is not NULL, its incremental or compressed stack is decoded in place.
 static __noinline __noreturn void _jumpto_stack(
   byte* cframes, ptrdiff_t size, byte* base,
-  lh_jmp_buf* entry, bool freecframes, struct exn_frame* exnframe, byte* no_opt )
+  lh_jmp_buf* entry, bool freecframes, struct exn_frame* exnframe, const resume* encoded, byte* no_opt )
 {
   if (no_opt != NULL) no_opt[0] = 0;
-  // copy the saved stack onto our stack
-  memcpy(base, cframes, size);         // this will not overwrite our stack frame 
-  if (freecframes) { free(cframes); }  // should be fine to call `free` (assuming it will not mess with the stack above its frame)
+  // copy the saved stack onto our stack; this will not overwrite our stack frame 
+  if (encoded != NULL) {
+    resume_cstack_decode(encoded, base);
+  }
+  else {
+    memcpy(base, cframes, size);
+  }
+  if (freecframes) { cstack_frames_free(cframes, size); }  // should be fine to call `free` (assuming it will not mess with the stack above its frame)
   // and jump 
   // _lh_longjmp_chain(*entry, cstack_bottom(&cs), exnframe);
   if (exnframe != NULL) {
@@ -1316,21 +2931,27 @@ static __noinline __noreturn void _jumpto_stack(
 
 /* jump to `entry` while restoring cstack `cs` and pushing handlers `hs` onto the global handler stack.
    Set `freecframes` to `true` to release the cstack after jumping.
+   If `encoded` is not NULL, `cs` is its incrementally captured or compressed stack.
 */
 static __noinline __noreturn void jumpto(
-  cstack* cs, lh_jmp_buf* entry, bool freecframes, struct exn_frame* exnframe ) 
+  cstack* cs, lh_jmp_buf* entry, bool freecframes, struct exn_frame* exnframe, const resume* encoded ) 
 {
   if (cs->frames == NULL) {
     // if no stack, just jump back down the stack; 
     // sanity: check if the entry is really below us!
     assert(exnframe==NULL);
     void* top = get_stack_top();
-    if (cs->base != NULL && stack_isbelow(top,cstack_top(cs))) {
+    if (cs->base != NULL && stack_same(top, cs->base) && stack_isbelow(top,cstack_top(cs))) {
       fatal(EFAULT,"Trying to jump up the stack to a scope that was already exited!");
     }
     // long jump back down direcly, no need to restore stacks
     _lh_longjmp(*entry, 1);
   }
+  else if (!stack_same(get_stack_top(), cs->base)) {
+    // restoring onto another (separate) stack can never overwrite our own frame
+    _jumpto_stack(cs->frames, cs->size, (byte*)cstack_base(cs),
+                  entry, freecframes, exnframe, encoded, NULL);
+  }
   else {
     // ensure there is enough room on the stack; 
     void* top = get_stack_top();
@@ -1346,7 +2967,7 @@ static __noinline __noreturn void jumpto(
     // that will not get overwritten itself when copying the new stack
     // void* exnframe = (resuming ? _lh_get_exn_frame(cstack_bottom(cs)) : NULL);
     _jumpto_stack(cs->frames, cs->size, (byte*)cstack_base(cs),
-                  entry, freecframes, exnframe, no_opt);
+                  entry, freecframes, exnframe, encoded, no_opt);
   }
 }
 
@@ -1356,7 +2977,7 @@ static __noinline __noreturn void jumpto_fragment(fragment* f, lh_value res)
 {
   assert(f->refcount >= 1);
   f->res = res; // set the argument in the cont slot  
-  jumpto(&f->cstack, &f->entry, false, NULL);
+  jumpto(&f->cstack, &f->entry, false, NULL, NULL);
 }
 
 
@@ -1368,20 +2989,35 @@ static __noinline __noreturn void jumpto_resume( resume* r, lh_value local, lh_v
   assert(is_effecthandler(h));
   if (r->refcount == 1) {
     h = hstack_append_movefrom(&__hstack, &r->hstack, hstack_bottom(&r->hstack));
-    hstack_free(&r->hstack, false /* no release */); // zero out the hstack in the resume since we moved it
+    resume_hstack_free(r, false /* no release */); // zero out the hstack in the resume since we moved it
   }
   else {
-    h = hstack_append_copyfrom(&__hstack, &r->hstack, hstack_bottom(&r->hstack)); // does not acquire h
+    // copy the frames; once we know none of them needs acquiring (e.g. under tail resumptive 
+    // handlers only) further copies of this resumption skip the scan.
+    h = hstack_append_movefrom(&__hstack, &r->hstack, hstack_bottom(&r->hstack)); // does not acquire h
+    if (!r->hstack_plain) {
+      r->hstack_plain = !hstack_acquire_above(&__hstack, h);
+    }
+    #ifdef _SEPSTACK
+    if (((effecthandler*)h)->sstack != NULL) sepstack_acquire(((effecthandler*)h)->sstack);
+    #endif
   }
   assert(is_effecthandler(h));
   ((effecthandler*)h)->local = local; // write new local directly into the hstack
   if (r->refcount==1) {
-    handler_acquire(h); // acquire now that the new local is in there (as it may alias the original)
+    effecthandler_acquire_local((effecthandler*)h); // acquire now that the new local is in there (as it may alias the original)
   }
   // and then restore the cstack and jump
   r->arg = arg;         // set the argument in the cont slot  
   r->resumptions++;     // increment resume count
-  jumpto(&r->cstack, &r->entry, false , r->exn_bottom);
+  if (profile_enabled) profile_restore(r->optag, r->cstack.size);
+  #ifdef _SEPSTACK
+  if (r->sstack != NULL) sepstack_restore(r);  // put the frames on the separate stack in place
+  #endif
+  if (r->sstack == NULL && r->cstack.frames != NULL && !r->compressed) {
+    __cstack_image = (r->image != NULL ? r->image : r);  // the restored stack is a good image for the next capture
+  }
+  jumpto(&r->cstack, &r->entry, false , r->exn_bottom, (resume_cstack_encoded(r) ? r : NULL));
 }
 
 
@@ -1390,8 +3026,8 @@ static __noinline __noreturn void jumpto_resume( resume* r, lh_value local, lh_v
   Capture stack
 -----------------------------------------------------------------*/
 
-// Copy part of the C stack into a context.
-static void capture_cstack(cstack* cs, const void* bottom, const void* top)
+// Copy part of the C stack into a context; uses the preallocated buffer `buf` if it has room.
+static void capture_cstack_into(cstack* cs, const void* bottom, const void* top, byte* buf, ptrdiff_t avail)
 {
   ptrdiff_t size = stack_diff(top, bottom);
   if (size <= 0) { // (stackdown ? top >= bottom : top <= bottom) {
@@ -1401,49 +3037,456 @@ static void capture_cstack(cstack* cs, const void* bottom, const void* top)
     cs->frames = NULL;
   }
   else {
-    // copy the stack 
+    // copy the stack; the platform memcpy is already vectorized and beat
+    // dedicated SSE2/AVX2 and non-temporal kernels at every size (see perf-stackcopy.c)
     cs->base = (bottom <= top ? bottom : top); // always lowest address
     cs->size = size;
-    cs->frames = (byte*)checked_malloc(size);
+    cs->frames = (size <= avail ? buf : cstack_frames_alloc(size));
     memcpy(cs->frames, cs->base, size);
   }
 }
 
-// Capture part of a handler stack (includeing h).
-static void capture_hstack(hstack* hs, hstack* to, effecthandler* h, bool copy) {
-  hstack_init(to);
-  if (copy) {
-    handler* toh = hstack_append_copyfrom(to, hs, to_handler(h));
-    handler_acquire(toh);
-  }
-  else {
-    hstack_append_movefrom(to, hs, to_handler(h));
-  }
+// Copy part of the C stack into a context.
+static void capture_cstack(cstack* cs, const void* bottom, const void* top) {
+  capture_cstack_into(cs, bottom, top, NULL, 0);
 }
 
 /*-----------------------------------------------------------------
-    Yield to handler
+  A resumption is allocated as one block together with its captured
+  handler frames and C stack: `[resume|hframes|cframes]`. The sizes
+  are determined before capturing; if the C stack turns out to be 
+  larger after all, its frames are allocated separately.
 -----------------------------------------------------------------*/
 
+#define RESUME_HSIZE  ((sizeof(resume) + 15) & ~((size_t)15))   // aligned size of the resume header
 
-#ifdef __cplusplus
-// Return to a handler by unwinding the handler stack and invoking any destructors.
-static void __noinline __noreturn yield_to_handler_unwind(effecthandler* h, const lh_operation* op, lh_value oparg)  {
-  throw lh_unwind_exception(h, op->opfun, oparg);
+// The expected size of the C stack to capture for a resumption from `bottom` to `top`
+static ptrdiff_t capture_resume_cstack_size(const void* bottom, const void* top) {
+  #ifdef _SEPSTACK
+  sepstack* s = sepstack_of(top);
+  if (s != NULL && s != sepstack_of(bottom)) top = s->parent_top;  // only the bridge is copied
+  #endif
+  ptrdiff_t size = stack_diff(top, bottom);
+  return (size > 0 ? size : 0);
+}
+
+// Allocate a resumption with room for `hsize` bytes of handler frames and `csize` bytes of C stack.
+static resume* resume_alloc(count hsize, ptrdiff_t csize) {
+  ptrdiff_t blocksize = RESUME_HSIZE + hsize + csize;
+  resume* r = (resume*)cstack_frames_alloc(blocksize);
+  r->blocksize = blocksize;
+  r->image = NULL;
+  r->compressed = false;
+  r->hstack_plain = false;
+  r->encsize = 0;
+  r->imagerefs = 0;
+  hstack* hs = &r->hstack;
+  hs->hframes = (byte*)r + RESUME_HSIZE;
+  hs->size = hsize;
+  hs->count = 0;
+  hs->top = hstack_at(hs, 0);
+  cstack_init(&r->cstack);
+  return r;
+}
+
+// The preallocated room for the C stack in a resumption block.
+static byte* resume_cframes(resume* r) {
+  return (byte*)r + RESUME_HSIZE + r->hstack.size;
+}
+
+// Free the captured handler stack of a resumption (which may be part of the resumption block).
+static void resume_hstack_free(resume* r, bool do_release) {
+  if (resume_block_contains(r, r->hstack.hframes)) {
+    if (do_release) hstack_release_frames(&r->hstack);
+    hstack_init(&r->hstack);
+  }
+  else {
+    hstack_free(&r->hstack, do_release);
+  }
+}
+
+/*-----------------------------------------------------------------
+  Incremental capture: a resumption that is captured after another
+  one was resumed (as in backtracking search) usually differs only in
+  its top frames. It then shares the captured stack of the resumed one
+  (its `image`) and only stores the blocks that differ as `cdelta` runs.
+  An image is never itself incrementally captured.
+-----------------------------------------------------------------*/
+
+#define CDELTA_BLOCK    (64)    // granularity at which the stack is compared with the image
+#define CDELTA_MAXRUNS  (32)    // with more differing runs the full stack is captured
+
+// A run of bytes that differ from the image; followed by the `size` bytes of the run.
+typedef struct _cdelta {
+  ptrdiff_t  offset;            // offset relative to the captured stack base
+  ptrdiff_t  size;              // byte size of the run
+} cdelta;
+
+static ptrdiff_t cdelta_runsize(ptrdiff_t size) {
+  return (ptrdiff_t)sizeof(cdelta) + ((size + 15) & ~((ptrdiff_t)15));
+}
+
+// Capture the C stack from `bottom` to `top` into `r` as the differences with the captured
+// stack of `image`. Returns `false` (capturing nothing) if it differs too much.
+static bool capture_cstack_delta(resume* r, resume* image, const void* bottom, const void* top)
+{
+  const cstack* ics = &image->cstack;
+  ptrdiff_t size = stack_diff(top, bottom);
+  if (size < 4*CDELTA_BLOCK || !stack_same(ics->base, bottom)) return false;
+  const byte* base = (const byte*)(bottom <= top ? bottom : top);
+  const byte* ibase = cstack_base(ics);
+  // find the runs of blocks that differ
+  cdelta runs[CDELTA_MAXRUNS];
+  count n = 0;
+  ptrdiff_t dirty = 0;
+  for (ptrdiff_t ofs = 0; ofs < size; ofs += CDELTA_BLOCK) {
+    ptrdiff_t len = (size - ofs < CDELTA_BLOCK ? size - ofs : CDELTA_BLOCK);
+    const byte* p = base + ofs;
+    if (p >= ibase && p + len <= ibase + ics->size && memcmp(p, ics->frames + (p - ibase), len) == 0) continue;
+    dirty += len;
+    if (dirty > size/2) return false;
+    if (n > 0 && runs[n-1].offset + runs[n-1].size == ofs) {
+      runs[n-1].size += len;
+    }
+    else if (n < CDELTA_MAXRUNS) {
+      runs[n].offset = ofs;
+      runs[n].size = len;
+      n++;
+    }
+    else return false;
+  }
+  if (n == 0) {  // always store a run so `cstack.frames` is not NULL
+    runs[0].offset = 0;
+    runs[0].size = 0;
+    n = 1;
+  }
+  // and store them
+  ptrdiff_t encsize = 0;
+  for (count i = 0; i < n; i++) encsize += cdelta_runsize(runs[i].size);
+  byte* frames = cstack_frames_alloc(encsize);
+  byte* q = frames;
+  for (count i = 0; i < n; i++) {
+    *((cdelta*)q) = runs[i];
+    memcpy(q + sizeof(cdelta), base + runs[i].offset, runs[i].size);
+    q += cdelta_runsize(runs[i].size);
+  }
+  r->cstack.base = base;
+  r->cstack.size = size;
+  r->cstack.frames = frames;
+  r->encsize = encsize;
+  r->image = image;
+  image->imagerefs++;
+  #ifdef _STATS
+  stats.rcont_captured_delta++;
+  stats.rcont_captured_delta_saved += size - encsize;
+  #endif
+  return true;
+}
+
+// Restore the incrementally captured stack of `r` into `dst` (which corresponds to `r->cstack.base`).
+static void cstack_restore_delta(const resume* r, byte* dst) {
+  assert(!r->image->compressed);
+  const cstack* cs = &r->cstack;
+  const cstack* ics = &r->image->cstack;
+  // copy the overlapping part of the image
+  const byte* lo = _max(cstack_base(cs), cstack_base(ics));
+  const byte* hi = _min(cstack_base(cs) + cs->size, cstack_base(ics) + ics->size);
+  if (hi > lo) memcpy(dst + (lo - cstack_base(cs)), ics->frames + (lo - cstack_base(ics)), hi - lo);
+  // and apply the differences
+  const byte* p = cs->frames;
+  while (p < cs->frames + r->encsize) {
+    const cdelta* d = (const cdelta*)p;
+    memcpy(dst + d->offset, p + sizeof(cdelta), d->size);
+    p += cdelta_runsize(d->size);
+  }
+}
+
+
+/*-----------------------------------------------------------------
+  Compressed stacks: the captured C stack of a parked resumption is
+  mostly zero padding and repeated pointers. It is compressed per
+  machine word as a sequence of tokens: a run of zero words, a run
+  of literal words, or a match that copies earlier words. Each token
+  starts with a varint `(n << 2) | tag`; a match is followed by its
+  distance, and a literal run by its words. Any remaining bytes
+  that do not fill a word are stored as is at the end.
+-----------------------------------------------------------------*/
+
+#define CZIP_ZEROS      (0)
+#define CZIP_LITERAL    (1)
+#define CZIP_MATCH      (2)
+#define CZIP_HASHBITS   (10)
+#define CZIP_MINSIZE    (256)     // smaller stacks are not compressed
+
+typedef uintptr_t czip_word;
+
+static size_t resume_compact_threshold = 0;  // 0: only explicitly (see `lh_resume_compact`)
+
+static czip_word czip_load(const byte* p) {
+  czip_word w;
+  memcpy(&w, p, sizeof(czip_word));
+  return w;
+}
+
+static count czip_hash(czip_word w) {
+  return (count)(((uint64_t)w * 0x9E3779B97F4A7C15ULL) >> (64 - CZIP_HASHBITS));
+}
+
+// Write a varint; returns NULL if there is no room
+static byte* czip_put(byte* q, const byte* end, size_t n) {
+  do {
+    if (q >= end) return NULL;
+    byte b = (byte)(n & 0x7F);
+    n >>= 7;
+    *q++ = (n != 0 ? (b | 0x80) : b);
+  } while (n != 0);
+  return q;
+}
+
+static const byte* czip_get(const byte* p, out size_t* n) {
+  size_t v = 0;
+  int shift = 0;
+  byte b;
+  do {
+    b = *p++;
+    v |= (size_t)(b & 0x7F) << shift;
+    shift += 7;
+  } while ((b & 0x80) != 0);
+  *n = v;
+  return p;
+}
+
+// Write the literal words `src[from,upto)`.
+static byte* czip_put_literals(byte* q, const byte* end, const byte* src, count from, count upto) {
+  if (from >= upto || q == NULL) return q;
+  q = czip_put(q, end, ((size_t)(upto - from) << 2) | CZIP_LITERAL);
+  ptrdiff_t n = (upto - from) * (ptrdiff_t)sizeof(czip_word);
+  if (q == NULL || end - q < n) return NULL;
+  memcpy(q, src + from*sizeof(czip_word), n);
+  return q + n;
+}
+
+// Compress `size` bytes at `src` into `dst`; returns the compressed size or -1 if it needs more than `avail` bytes.
+static ptrdiff_t czip_compress(const byte* src, ptrdiff_t size, byte* dst, ptrdiff_t avail) {
+  count last[1 << CZIP_HASHBITS];   // the last word index with a given hash
+  memset(last, 0xFF, sizeof(last));
+  const count words = size / (ptrdiff_t)sizeof(czip_word);
+  const byte* end = dst + avail;
+  byte* q = dst;
+  count lit = 0;  // start of pending literal words
+  count i = 0;
+  while (i < words && q != NULL) {
+    czip_word w = czip_load(src + i*sizeof(czip_word));
+    count n = 0;
+    if (w == 0) {
+      // run of zeros
+      do { n++; } while (i + n < words && czip_load(src + (i + n)*sizeof(czip_word)) == 0);
+      if (n >= 2) {
+        q = czip_put_literals(q, end, src, lit, i);
+        if (q != NULL) q = czip_put(q, end, ((size_t)n << 2) | CZIP_ZEROS);
+        i += n;
+        lit = i;
+        continue;
+      }
+    }
+    else {
+      // match with an earlier word with the same hash
+      count h = czip_hash(w);
+      count j = last[h];
+      last[h] = i;
+      if (j >= 0) {
+        while (i + n < words && czip_load(src + (j + n)*sizeof(czip_word)) == czip_load(src + (i + n)*sizeof(czip_word))) n++;
+        if (n >= 2) {
+          q = czip_put_literals(q, end, src, lit, i);
+          if (q != NULL) q = czip_put(q, end, ((size_t)n << 2) | CZIP_MATCH);
+          if (q != NULL) q = czip_put(q, end, (size_t)(i - j));
+          i += n;
+          lit = i;
+          continue;
+        }
+      }
+    }
+    i++;
+  }
+  q = czip_put_literals(q, end, src, lit, words);
+  // and the remaining bytes
+  ptrdiff_t rest = size - words*(ptrdiff_t)sizeof(czip_word);
+  if (q == NULL || end - q < rest) return -1;
+  memcpy(q, src + words*sizeof(czip_word), rest);
+  return (q + rest) - dst;
+}
+
+// Decompress `src` into `size` bytes at `dst`.
+static void czip_decompress(const byte* src, byte* dst, ptrdiff_t size) {
+  const count words = size / (ptrdiff_t)sizeof(czip_word);
+  count i = 0;
+  while (i < words) {
+    size_t v;
+    src = czip_get(src, &v);
+    count n = (count)(v >> 2);
+    byte* q = dst + i*sizeof(czip_word);
+    switch (v & 3) {
+    case CZIP_ZEROS:
+      memset(q, 0, n * sizeof(czip_word));
+      break;
+    case CZIP_LITERAL:
+      memcpy(q, src, n * sizeof(czip_word));
+      src += n * sizeof(czip_word);
+      break;
+    default: {
+      size_t dist;
+      src = czip_get(src, &dist);
+      const byte* p = q - dist*sizeof(czip_word);
+      for (count k = 0; k < n; k++) {  // may overlap
+        memcpy(q + k*sizeof(czip_word), p + k*sizeof(czip_word), sizeof(czip_word));
+      }
+    }
+    }
+    i += n;
+  }
+  memcpy(dst + words*sizeof(czip_word), src, size - words*sizeof(czip_word));
+}
+
+// Compress the captured C stack of a resumption; only if it is not shared with 
+// other resumptions and stored outside the resumption block. 
+static bool resume_cstack_compress(resume* r) {
+  cstack* cs = &r->cstack;
+  if (cs->frames == NULL || cs->size < CZIP_MINSIZE ||
+      resume_cstack_encoded(r) || r->imagerefs > 0 || resume_block_contains(r, cs->frames)) return false;
+  // it should save at least a quarter
+  ptrdiff_t avail = cs->size - cs->size/4;
+  byte* buf = cstack_frames_alloc(avail);
+  ptrdiff_t zsize = czip_compress(cs->frames, cs->size, buf, avail);
+  if (zsize < 0) {
+    cstack_frames_free(buf, avail);
+    return false;
+  }
+  byte* frames = cstack_frames_alloc(zsize);
+  memcpy(frames, buf, zsize);
+  cstack_frames_free(buf, avail);
+  cstack_frames_free(cs->frames, cs->size);
+  if (__cstack_image == r) __cstack_image = NULL;
+  __resume_live_size -= cs->size - zsize;
+  #ifdef _STATS
+  stats.rcont_compressed++;
+  stats.rcont_compressed_saved += cs->size - zsize;
+  #endif
+  cs->frames = frames;
+  r->encsize = zsize;
+  r->compressed = true;
+  return true;
+}
+
+// Restore the encoded C stack of `r` into `dst` (which corresponds to `r->cstack.base`).
+static void resume_cstack_decode(const resume* r, byte* dst) {
+  if (r->compressed) {
+    czip_decompress(r->cstack.frames, dst, r->cstack.size);
+  }
+  else {
+    cstack_restore_delta(r, dst);
+  }
+}
+
+// Turn an incrementally captured or compressed stack into a full one.
+static void resume_cstack_expand(resume* r) {
+  if (!resume_cstack_encoded(r)) return;
+  byte* frames = cstack_frames_alloc(r->cstack.size);
+  resume_cstack_decode(r, frames);
+  cstack_frames_free(r->cstack.frames, r->encsize);
+  __resume_live_size += r->cstack.size - r->encsize;
+  r->cstack.frames = frames;
+  r->encsize = 0;
+  r->compressed = false;
+  resume* image = r->image;
+  if (image != NULL) {
+    r->image = NULL;
+    image->imagerefs--;
+    if (image->imagerefs == 0 && image->refcount == -1) resume_block_free(image);
+  }
+}
+
+bool lh_resume_compact(lh_resume r) {
+  if (is_tailresume(r) || r->rkind == PromotedResume) return false;
+  return resume_cstack_compress((resume*)r);
+}
+
+void lh_set_resume_compact_threshold(size_t threshold) {
+  resume_compact_threshold = threshold;
+}
+
+// Capture the C stack of a resumption from `bottom` to `top`. If `top` is on
+// a separate stack, its frames stay in place and only the parent stack is copied.
+// If `image` is not NULL, try to capture incrementally first.
+static void capture_resume_cstack(resume* r, resume* image, const void* bottom, const void* top)
+{
+  r->sstack = NULL;
+  cstack_init(&r->sepcstack);
+  #ifdef _SEPSTACK
+  sepstack* s = sepstack_of(top);
+  if (s != sepstack_of(bottom)) {
+    if (s == NULL || sepstack_of(bottom) != NULL) {
+      fatal(ENOTSUP, "cannot capture a resumption across separate stacks");
+    }
+    sepstack_capture(s, r, top);
+    top = s->parent_top;
+  }
+  #endif
+  if (image != NULL && r->sstack == NULL && capture_cstack_delta(r, image, bottom, top)) return;
+  byte* buf = resume_cframes(r);
+  capture_cstack_into(&r->cstack, bottom, top, buf, (byte*)r + r->blocksize - buf);
+}
+
+// Capture part of a handler stack (includeing h); `to` should be initialized.
+static void capture_hstack(hstack* hs, hstack* to, effecthandler* h, bool copy) {
+  if (copy) {
+    handler* toh = hstack_append_copyfrom(to, hs, to_handler(h));
+    handler_acquire(toh);
+  }
+  else {
+    hstack_append_movefrom(to, hs, to_handler(h));
+  }
+}
+
+/*-----------------------------------------------------------------
+    Yield to handler
+-----------------------------------------------------------------*/
+
+
+// Pass the arguments of `lh_yield2/3/4` in the handler frame as the C stack 
+// of the yield is captured or unwound before the operation function is called.
+static void handler_set_fixedargs(effecthandler* h, const fixedargs* fargs) {
+  if (fargs == NULL) {
+    h->arg_fixed.argcount = 0;
+  }
+  else {
+    h->arg_fixed = *fargs;
+  }
+}
+
+#ifdef __cplusplus
+// Return to a handler by unwinding the handler stack and invoking any destructors.
+// If `op` is `NULL` the `oparg` is returned directly as the result of the handler.
+static void __noinline __noreturn yield_to_handler_unwind(effecthandler* h, const lh_operation* op, lh_value oparg, const fixedargs* fargs)  {
+  handler_set_fixedargs(h, fargs);
+  throw lh_unwind_exception(h, (op == NULL ? NULL : op->opfun), oparg);
 }
 #endif
 
 // Return to a handler by unwinding the handler stack.
 static void __noinline __noreturn yield_to_handler(hstack* hs, effecthandler* h,
-  resume* resume, const lh_operation* op, lh_value oparg, bool do_release)
+  resume* resume, const lh_operation* op, lh_value oparg, const fixedargs* fargs, bool do_release)
 {
+  #ifdef __cplusplus
+  assert((h->flags & HDEF_TAILONLY) == 0); // tail-only handlers have no entry point
+  #endif
   cstack cs;
   cstack_init(&cs);
-  hstack_pop_upto(hs, to_handler(h), do_release, &cs);
+  hstack_pop_upto(hs, to_handler(h), do_release, h->stackbase, &cs);
   h->arg = oparg;
   h->arg_op = op;
   h->arg_resume = resume;
-  jumpto(&cs, &h->entry, true, NULL);
+  handler_set_fixedargs(h, fargs);
+  jumpto(&cs, &h->entry, true, NULL, NULL);
 }
 
 
@@ -1473,7 +3516,7 @@ public:
 static __noinline lh_value capture_resume_call(hstack* hs, resume* r, lh_value resumelocal, lh_value resumearg)
 {
   // initialize continuation
-  fragment* f = (fragment*)checked_malloc(sizeof(fragment));
+  fragment* f = (fragment*)cstack_frames_alloc(sizeof(fragment));
   f->refcount = 1;
   f->res = lh_value_null; 
   #ifdef __cplusplus
@@ -1506,11 +3549,27 @@ static __noinline lh_value capture_resume_call(hstack* hs, resume* r, lh_value r
   else {
     // we set our jump point; now capture the stack upto the stack base of the continuation 
     void* top = get_stack_top();
-    capture_cstack(&f->cstack, cstack_bottom(&r->cstack), top);
-    #ifdef _STATS
-    if (f->cstack.frames == NULL) stats.rcont_captured_empty++;
-    stats.rcont_captured_size += (long)f->cstack.size;
-    #endif
+    if (!stack_same(top, cstack_bottom(&r->cstack))) {
+      fatal(ENOTSUP, "cannot resume on another stack than where the handler was installed");
+    }
+    if (!stack_isbelow(cstack_bottom(&r->cstack), top)) {
+      // the resumed stack lies above us and will not overwrite our frames (as when resuming from an
+      // event loop); the fragment is only needed as the jump point to return here
+      f->cstack.base = cstack_bottom(&r->cstack);
+      f->cstack.size = 0;
+      f->cstack.frames = NULL;
+      #ifdef _STATS
+      stats.rcont_captured_empty++;
+      #endif
+    }
+    else {
+      capture_cstack(&f->cstack, cstack_bottom(&r->cstack), top);
+      if (profile_enabled) profile_fragment(r->optag, f->cstack.size);
+      #ifdef _STATS
+      if (f->cstack.frames == NULL) stats.rcont_captured_empty++;
+      stats.rcont_captured_size += (long)f->cstack.size;
+      #endif
+    }
     // push a special "fragment" frame to remember to restore the stack when yielding to a handler across non-scoped resumes
     hstack_push_fragment(hs, f);
     // and now jump to the entry with resume arg
@@ -1518,12 +3577,31 @@ static __noinline lh_value capture_resume_call(hstack* hs, resume* r, lh_value r
   }
 }
 
+#ifndef __cplusplus
+// Is `r` resumed in tail position of the operation function that received it?
+// That is the case if the scoped frame that `handle_with` pushed for `r` is still 
+// on top. The resumed handler then returns to `handle_with` just like the operation 
+// function would, and no fragment is needed to return to the operation first.
+static bool resume_is_direct(hstack* hs, const resume* r) {
+  if (hstack_empty(hs)) return false;
+  const handler* h = hstack_top(hs);
+  return (is_scopedhandler(h) && ((const scopedhandler*)h)->resume == r);
+}
+#endif
+
 // Capture a first-class resumption and yield to the handler.
-static __noinline lh_value capture_resume_yield(hstack* hs, effecthandler* h, const lh_operation* op, lh_value oparg )
+static __noinline lh_value capture_resume_yield(hstack* hs, effecthandler* h, const lh_operation* op, lh_value oparg, const fixedargs* fargs )
 {
-  // initialize continuation
-  resume* r = (resume*)checked_malloc(sizeof(resume));
+  // initialize continuation in one block with room for the handler frames and C stack to capture;
+  // if there is an image to capture incrementally against, the C stack is likely much smaller, and
+  // a general resumption may be parked so its C stack is stored separately where it can be compressed
+  resume* image = __cstack_image;
+  bool separate = (op->opkind > LH_OP_SCOPED);
+  resume* r = resume_alloc(hstack_indexof(hs, to_handler(h)), 
+                           (image != NULL || separate ? 0 : capture_resume_cstack_size(h->stackbase, get_stack_top())));
   r->lhresume.rkind = (op->opkind<=LH_OP_SCOPED ? ScopedResume : GeneralResume);
+  r->optag = op->optag;
+  r->op = op;
   r->refcount = 1;
   r->resumptions = 0;
   r->exn_bottom = h->exn_frame;
@@ -1552,17 +3630,205 @@ static __noinline lh_value capture_resume_yield(hstack* hs, effecthandler* h, co
   else {
     // we set our jump point; now capture the stack upto the handler
     void* top = get_stack_top();
-    capture_cstack(&r->cstack, h->stackbase, top);
+    capture_resume_cstack(r, image, h->stackbase, top);
+    __resume_live_size += resume_cstack_stored(r);
+    if (profile_enabled) profile_capture(r->optag, r->cstack.size);
+    if (separate && resume_compact_threshold > 0 && __resume_live_size > 0 && (size_t)__resume_live_size > resume_compact_threshold) resume_cstack_compress(r);
     // capture hstack
     capture_hstack(hs, &r->hstack, h, false );
     #ifdef _STATS
     if (r->cstack.frames == NULL) stats.rcont_captured_empty++;
-    stats.rcont_captured_size += (long)r->cstack.size + (long)r->hstack.size;
+    stats.rcont_captured_size += (long)resume_cstack_stored(r) + (long)r->hstack.size;
     #endif
     assert(h->hdef == ((effecthandler*)(r->hstack.hframes))->hdef); // same handler?
     // and yield to the handler
-    yield_to_handler(hs, h, r, op, oparg, false /* we moved the frames to the resumption */ );
+    yield_to_handler(hs, h, r, op, oparg, fargs, false /* we moved the frames to the resumption */ );
+  }
+}
+
+
+/*-----------------------------------------------------------------
+  Promoted yield
+  A promoted operation function is called directly, just like a tail
+  resumptive operation, but it still receives a first-class resumption.
+  Only if that resumption is used other than with `lh_tail_resume`, it
+  is captured after all: either when the operation function resumes it
+  with `lh_call_resume` or `lh_release_resume`, or when the function
+  returns without resuming (as a general operation may keep it). Until 
+  then the C stack from the handler up to the yield, and the handler 
+  frames from the handler up to the top, are still in place. After such
+  capture the operation is demoted again for later yields.
+-----------------------------------------------------------------*/
+
+// Capture the resumption of a promoted operation after all.
+static void promoted_capture(resume* r) {
+  assert(r->lhresume.rkind == PromotedResume);
+  promotedyield* py = &r->promoted;
+  // capturing starts a new generation, so a pending region must become a skip frame first
+  if (hstack_tailskip.toskip > 0) tailskip_push(&__hstack);
+  // the handler frames at the yield; the operation function may have pushed more since
+  hstack region = __hstack;
+  region.count = py->hcount;
+  region.top = hstack_at(&region, py->htopsize);
+  effecthandler* h = (effecthandler*)hstack_at(&region, py->skipped);
+  assert(is_effecthandler(to_handler(h)));
+  capture_resume_cstack(r, NULL, h->stackbase, py->top);
+  __resume_live_size += resume_cstack_stored(r);
+  if (profile_enabled) profile_capture(r->optag, r->cstack.size);
+  // copy the frames as they stay in place until we return to the handler
+  hstack_init(&r->hstack);
+  capture_hstack(&region, &r->hstack, h, true);
+  #ifdef _STATS
+  stats.rcont_captured_resume++;
+  if (r->cstack.frames == NULL) stats.rcont_captured_empty++;
+  stats.rcont_captured_size += (long)resume_cstack_stored(r) + (long)r->hstack.size;
+  #endif
+  // the operation function gets its own reference (unless scoped), and `promoted_yield` keeps one
+  r->lhresume.rkind = (r->op->opkind <= LH_OP_SCOPED ? ScopedResume : GeneralResume);
+  r->refcount = (r->lhresume.rkind == ScopedResume ? 1 : 2);
+  promote_demote(r->op);
+}
+
+// Allocate the header of a promoted resumption; usually the one of the previous promoted yield.
+static resume* promoted_alloc() {
+  resume* r = promoted_spare;
+  if (r != NULL) {
+    promoted_spare = NULL;  // it was never captured so its fields are still as allocated
+    return r;
+  }
+  return resume_alloc(0, 0);
+}
+
+// Release the resumption of `promoted_yield` (or only our reference if it was captured).
+static void promoted_release(resume* r) {
+  if (r->lhresume.rkind != PromotedResume) {
+    resume_release(r);
+  }
+  else if (promoted_spare == NULL) {
+    promoted_spare = r;
+  }
+  else {
+    cstack_frames_free((byte*)r, r->blocksize);
+  }
+}
+
+#ifdef __cplusplus
+// Rethrow an exception of a promoted operation function from its handler.
+static lh_value promoted_rethrow(lh_resume r, lh_value local, lh_value arg) {
+  std::exception_ptr* p = (std::exception_ptr*)lh_ptr_value(arg);
+  std::exception_ptr eptr;
+  std::swap(eptr, *p);
+  delete p;
+  std::rethrow_exception(eptr);
+}
+
+// Yielded to the handler to rethrow an exception; it has no tag as it belongs to any effect.
+static const lh_operation promoted_rethrow_op = { LH_OP_NORESUME, lh_op_null, &promoted_rethrow };
+#endif
+
+// Yield to promoted operation `op` of handler `h`, which is `skipped` bytes down the handler stack.
+static __noinline lh_value promoted_yield(hstack* hs, effecthandler* h, const lh_operation* op, count skipped, lh_value arg)
+{
+  // allocate just the resumption header; the frames are only allocated if it is captured
+  resume* r = promoted_alloc();
+  r->lhresume.rkind = PromotedResume;
+  r->optag = op->optag;
+  r->op = op;
+  r->refcount = 1;
+  r->resumptions = 0;
+  r->exn_bottom = h->exn_frame;
+  r->arg = lh_value_null;
+  #ifdef _STATS
+  stats.operations_promoted++;
+  #endif
+  // set our jump point in case it is captured after all
+  if (_lh_setjmp(r->entry) != 0) {
+    // longjmp back here when the captured resumption is called
+    lh_value res = r->arg;
+    #ifdef _STATS
+    stats.rcont_resumed_resume++;
+    #endif
+    #ifdef __cplusplus
+    if (r->resumptions <= 0) {
+      throw lh_resume_unwind_exception(r); // unwind for a resumption that was never resumed
+    }
+    #endif
+    resume_release(r);
+    return res;
+  }
+  promotedyield* py = &r->promoted;
+  py->top = get_stack_top();
+  py->hcount = hs->count;
+  py->htopsize = hstack_topsize(hs);
+  py->skipped = skipped;
+  py->local = h->local;
+  py->resumed = false;
+  py->released = false;
+  lh_value res = lh_value_null;
+  #ifdef __cplusplus
+  std::exception_ptr* eptr = NULL;
+  try {
+  #endif
+    // hide the handlers from `h` upward with a pending skip region and call the operation function directly
+    tailskip saved = tailskip_begin(skipped);
+    {
+      #ifdef __cplusplus
+      raii_tailskip_end do_end(hs, &saved);
+      #endif
+      res = op->opfun(&r->lhresume, h->local, arg);
+      #ifndef __cplusplus
+      tailskip_end(hs, &saved);
+      #endif
+    }
+  #ifdef __cplusplus
+  }
+  catch (const lh_unwind_exception&) {
+    promoted_release(r);  // unwinding to an outer handler
+    throw;
+  }
+  catch (const lh_resume_unwind_exception&) {
+    promoted_release(r);
+    throw;
+  }
+  catch (...) {
+    // an unpromoted operation function would raise this at the handler, not inside the action
+    eptr = new std::exception_ptr(std::current_exception());
+  }
+  #endif
+  h = (effecthandler*)hstack_at(hs, skipped);  // the handler stack may have been reallocated
+  assert(is_effecthandler(to_handler(h)));
+  #ifdef __cplusplus
+  if (eptr != NULL) {
+    // like an unpromoted operation, the frames are not unwound (as those of a released resumption)
+    promoted_release(r);
+    yield_to_handler(hs, h, NULL, &promoted_rethrow_op, lh_value_ptr(eptr), NULL, true);
+  }
+  #endif
+  if (r->lhresume.rkind == PromotedResume) {
+    // if we returned from a `lh_tail_resume` we just return its result
+    if (py->resumed) {
+      h->local = py->local;
+      promoted_release(r);
+      return res;
+    }
+    // a general operation may have kept its resumption: capture it now
+    if (op->opkind > LH_OP_SCOPED && !py->released) {
+      promoted_capture(r);
+    }
+    // otherwise it is gone; yield back to the handler with the result
+    else {
+      promoted_release(r);
+      #ifdef __cplusplus
+      yield_to_handler_unwind(h, NULL, res, NULL);  // unwind through destructors on no-resume
+      #else
+      yield_to_handler(hs, h, NULL, NULL, res, NULL, true);
+      #endif
+    }
   }
+  // the captured resumption has its own copy of the frames above us;
+  // yield back to the handler with the result without unwinding
+  promoted_release(r);
+  yield_to_handler(hs, h, NULL, NULL, res, NULL, true);
 }
 
 
@@ -1594,15 +3860,72 @@ public:
 };
 #endif
 
+// Run the `action` under a freshly pushed handler `h` and pop it when done.
+static lh_value handle_action(hstack* hs, effecthandler* h, lh_value(*action)(lh_value), lh_value arg)
+{
+  #if defined(__cplusplus) || !defined(NDEBUG)
+  const handlerid id = h->id;
+  #endif
+  #ifndef NDEBUG
+  const lh_handlerdef* hdef = h->hdef;
+  void* base = h->stackbase;
+  #endif
+  lh_value res;
+  lh_resultfun* resfun = NULL;
+  lh_value local = lh_value_null;
+  #ifdef __cplusplus
+  {
+    raii_hstack_pop do_pop(hs, true, h->hdef->effect);
+    try {
+      #endif
+      #ifdef _SEPSTACK
+      if (h->sstack != NULL) {
+        res = sepstack_run(h->sstack, action, arg);
+      }
+      else
+      #endif
+      res = action(arg);
+      assert(hs == &__hstack);
+      h = (effecthandler*)hstack_top(hs);  // re-load our handler since the handler stack could have been reallocated
+      #ifndef NDEBUG
+      assert(id == h->id);
+      assert(hdef == h->hdef);
+      assert(base == h->stackbase);
+      #endif
+      // pop our handler
+      if ((h->flags & HDEF_RESULT) != 0) resfun = h->hdef->resultfun;
+      local = h->local;
+      #ifndef __cplusplus
+      hstack_pop(hs, true);
+      #else
+    }
+    catch (const lh_unwind_exception& exn) {
+      if (exn.handler == NULL || exn.handler->id != id) throw; // rethrow to other handler
+      res = exn.res;
+      if (exn.opfun != NULL) {
+        fixedargs fargs;
+        if (exn.handler->arg_fixed.argcount > 0) {
+          fargs = exn.handler->arg_fixed;
+          res = lh_value_any_ptr(&fargs);
+        }
+        res = exn.opfun(NULL, exn.handler->local, res); // LH_OP_NORESUME
+      }
+    }
+  }
+  #endif
+  if (resfun != NULL) {
+    res = resfun(local, res);
+  }
+  return res;
+}
+
 // Start a handler 
 static __noinline lh_value handle_with(
   hstack* hs, effecthandler* h, lh_value(*action)(lh_value), lh_value arg )
 {
   // set the handler entry point 
-  #if defined(__cplusplus) || !defined(NDEBUG)
-  const count id = h->id;
-  #endif
   #ifndef NDEBUG
+  const handlerid id = h->id;
   const lh_handlerdef* hdef = h->hdef;
   void* base = h->stackbase;
   #endif
@@ -1625,7 +3948,19 @@ static __noinline lh_value handle_with(
     lh_value  local  = h->local;
     resume*   resume = h->arg_resume;
     const lh_operation* op = h->arg_op;
-    assert(op == NULL || op->optag->effect == h->handler.effect);
+    assert(op == NULL || op->optag == lh_op_null /* promoted_rethrow_op */ || op->optag->effect == h->handler.effect);
+    fixedargs fargs;
+    if (h->arg_fixed.argcount > 0) {
+      fargs = h->arg_fixed;  // copy as our frame is popped
+      res = lh_value_any_ptr(&fargs);
+    }
+    #ifdef _SEPSTACK
+    if (op != NULL && op->opkind <= LH_OP_NORESUME && h->sstack != NULL) {
+      // the action on the separate stack is abandoned
+      sepstack_release(h->sstack);
+      h->sstack = NULL;
+    }
+    #endif
     hstack_pop(hs, (op==NULL) /*|| !op_is_release(op)*/ ); // no release if moved into resumption
     if (op != NULL && op->opfun != NULL) {
       // push a scoped frame if necessary
@@ -1653,59 +3988,35 @@ static __noinline lh_value handle_with(
   }
   else {
     // we set up the handler, now call the action 
-    lh_value res;
-    lh_resultfun* resfun = NULL;
-    lh_value local = lh_value_null;
-    #ifdef __cplusplus
-    {
-      raii_hstack_pop do_pop(hs, true, h->hdef->effect);
-      try {
-        #endif
-        res = action(arg);
-        assert(hs == &__hstack);
-        h = (effecthandler*)hstack_top(hs);  // re-load our handler since the handler stack could have been reallocated
-        #ifndef NDEBUG
-        assert(id == h->id);
-        assert(hdef == h->hdef);
-        assert(base == h->stackbase);
-        #endif
-        // pop our handler
-        resfun = h->hdef->resultfun;
-        local = h->local;
-        #ifndef __cplusplus
-        hstack_pop(hs, true);
-        #else
-      }
-      catch (const lh_unwind_exception& exn) {
-        if (exn.handler == NULL || exn.handler->id != id) throw; // rethrow to other handler
-        res = exn.res;
-        if (exn.opfun != NULL) {
-          res = exn.opfun(NULL, exn.handler->local, res); // LH_OP_NORESUME
-        }
-      }
-    }
-    #endif
-    if (resfun != NULL) {
-      res = resfun(local, res);
-    }
-    return res;
+    return handle_action(hs, h, action, arg);
   }
 }
 
 // `handle_upto` installs a handler on the stack with a given stack `base`. 
+// If `s` is not `NULL`, the action is run on that separate stack.
 static __noinline lh_value handle_upto(hstack* hs, void* base, const lh_handlerdef* def,
-  lh_value local, lh_value(*action)(lh_value), lh_value arg)
+  lh_value local, lh_value(*action)(lh_value), lh_value arg, sepstack* s)
 {
   // allocate handler frame on the stack so it will be part of a captured continuation
   effecthandler* h = hstack_push_effect(hs, def, base, local);
+  h->sstack = s;
   fragment* fragment;
   lh_value res;
   #ifdef __cplusplus
   try {
     h->exn_frame = _lh_get_exn_top();
     assert(h->exn_frame == NULL || stack_isbelow(base, h->exn_frame));
-  #endif
+    // tail-only handlers need no entry point: an operation that returns without
+    // resuming unwinds to `handle_action` with an exception instead (see `yieldop`)
+    if ((h->flags & HDEF_TAILONLY) != 0) {
+      res = handle_action(hs, h, action, arg);
+    }
+    else {
+      res = handle_with(hs, h, action, arg);
+    }
+  #else
     res = handle_with(hs, h, action, arg);
+  #endif
     fragment = hstack_pop_fragment(hs);
   #ifdef __cplusplus
   }
@@ -1732,11 +4043,29 @@ __noinline lh_value lh_handle( const lh_handlerdef* def, lh_value local, lh_acti
   hstack* hs = &__hstack;
   lh_value res;
   LH_INIT(hs)
-  res = handle_upto(hs, &base, def, local, action, arg);
+  res = handle_upto(hs, &base, def, local, action, arg, NULL);
   LH_DONE(hs)
   return res;
 }
 
+// `lh_handle_separate` is like `lh_handle` but runs the action on a separate stack.
+__noinline lh_value lh_handle_separate(const lh_handlerdef* def, lh_value local, lh_actionfun* action, lh_value arg)
+{
+  #ifdef _SEPSTACK
+  void* base = NULL;
+  if (sepstack_of(&base) == NULL) {
+    hstack* hs = &__hstack;
+    lh_value res;
+    LH_INIT(hs)
+    res = handle_upto(hs, &base, def, local, action, arg, sepstack_alloc());
+    LH_DONE(hs)
+    return res;
+  }
+  #endif
+  // not supported, or already on a separate stack
+  return lh_handle(def, local, action, arg);
+}
+
 
 /*-----------------------------------------------------------------
   Linear handlers only have tail resume operations that do not exit themselves.
@@ -1766,14 +4095,14 @@ lh_raii_linear_handler::~lh_raii_linear_handler() {
 }
 
 #else
-ptrdiff_t _lh_linear_handler_init(const lh_handlerdef* hdef, lh_value local, bool* init) {
+uint64_t _lh_linear_handler_init(const lh_handlerdef* hdef, lh_value local, bool* init) {
   hstack* hs = &__hstack;
   bool _init = lh_init(hs); if (init != NULL) *init = _init;
   effecthandler* h = hstack_push_effect(hs, hdef, NULL /*no base*/, local);
   return h->id;
 }
 
-void _lh_linear_handler_done(ptrdiff_t id, bool init, bool do_release) {
+void _lh_linear_handler_done(uint64_t id, bool init, bool do_release) {
   hstack* hs = &__hstack;
 #ifndef NDEBUG
   handler* top = hstack_top(hs);
@@ -1798,24 +4127,19 @@ lh_value _lh_implicit_get(lh_resume r, lh_value local, lh_value arg) {
   Yield an operation
 -----------------------------------------------------------------*/
 
-// `yieldop` yields to the first enclosing handler that can handle
-//   operation `optag` and passes it the argument `arg`.
-static lh_value yieldop(lh_optag optag, lh_value arg)
+// `yieldop_to` yields operation `op` to handler `h`, which is `skipped` bytes down
+//   the handler stack, and passes it the argument `arg`.
+//   For `lh_yield2/3/4`, `arg` points to the arguments in `fargs` (and `fargs` is `NULL` otherwise).
+static lh_value yieldop_to(hstack* hs, effecthandler* h, const lh_operation* op, count skipped, lh_value arg, const fixedargs* fargs)
 {
-  // find the operation handler along the handler stack
-  hstack*   hs = &__hstack;
-  count     skipped;
-  const lh_operation* op;
-  effecthandler* h = hstack_find(hs, optag, &op, &skipped);
-
   // No resume (i.e. like `throw`)
   if (op->opkind <= LH_OP_NORESUME) {
     #ifdef __cplusplus
     if (op->opkind != LH_OP_NORESUMEX) {
-      yield_to_handler_unwind(h, op, arg);  // unwind through destructors
+      yield_to_handler_unwind(h, op, arg, fargs);  // unwind through destructors
     }
     #endif
-    yield_to_handler(hs, h, NULL, op, arg, op_is_release(op) );
+    yield_to_handler(hs, h, NULL, op, arg, fargs, op_is_release(op) );
   }
   
   // Tail resumptions
@@ -1828,21 +4152,20 @@ static lh_value yieldop(lh_optag optag, lh_value arg)
     assert((void*)(&r.lhresume) == (void*)&r);
     lh_value res;
     if (op->opkind != LH_OP_TAIL_NOOP) {
-      // push a skip frame
-      hstack_push_skip(hs, skipped);
-      count hidx = hstack_indexof(hs, to_handler(h));
-      #ifdef __cplusplus
-      raii_hstack_pop do_pop(hs, false /* skip frames need no release */, LH_EFFECT(__skip));
-      #endif
-      // call the operation handler directly for a tail resumption
-      res = op->opfun(&r.lhresume, h->local, arg);
-      h = (effecthandler*)hstack_at(hs, hidx);
+      // hide the handlers from `h` upward with a pending skip region
+      tailskip saved = tailskip_begin(skipped);
+      {
+        #ifdef __cplusplus
+        raii_tailskip_end do_end(hs, &saved);
+        #endif
+        // call the operation handler directly for a tail resumption
+        res = op->opfun(&r.lhresume, h->local, arg);
+        #ifndef __cplusplus
+        tailskip_end(hs, &saved);
+        #endif
+      }
+      h = (effecthandler*)hstack_at(hs, skipped);  // the handler stack may have been reallocated
       assert(is_effecthandler(to_handler(h)));
-      #ifndef __cplusplus
-      assert(!hstack_empty(hs));
-      assert(is_skiphandler(hstack_top(hs)));
-      hstack_pop(hs,false); // skip frames need no release
-      #endif
     }
     // OP_TAIL_NOOP: will not call operations so no need for a skip frame
     // call the operation function and return directly (as it promised to tail resume)
@@ -1858,29 +4181,183 @@ static lh_value yieldop(lh_optag optag, lh_value arg)
     // otherwise no resume was called; yield back to the handler with the result.
     else {
       #ifdef __cplusplus
-      yield_to_handler_unwind(h, op, res);  // unwind through destructors on no-resume
+      yield_to_handler_unwind(h, NULL, res, NULL);  // unwind through destructors on no-resume
       #else
-      yield_to_handler(hs, h, NULL, NULL, res, true);
+      yield_to_handler(hs, h, NULL, NULL, res, NULL, true);
       #endif
     }
   }
 
+  // Promoted scoped and general operations (but not on a separate stack, where
+  // the operation function could not resume a resumption that is captured after all)
+  else if (promote_threshold > 0 && op_is_promoted(op) && sepstack_of(get_stack_top()) == NULL) {
+    if (hstack_tailskip.toskip > 0) {
+      // the handler frames may be captured and then need the pending region as a skip frame
+      tailskip_push(hs);
+      skipped += (count)sizeof(skiphandler);
+      h = (effecthandler*)hstack_at(hs, skipped);
+    }
+    return promoted_yield(hs, h, op, skipped, arg);
+  }
+
   // In general, capture a resumption and yield to the handler
   else {
-    return capture_resume_yield(hs, h, op, arg);
+    if (hstack_tailskip.toskip > 0) {
+      // the captured handler frames need the pending region as a skip frame
+      tailskip_push(hs);
+      h = (effecthandler*)hstack_at(hs, skipped + (count)sizeof(skiphandler));
+    }
+    return capture_resume_yield(hs, h, op, arg, fargs);
   }
 
   assert(false);
   return lh_value_null;
 }
 
+// `yieldop` yields to the first enclosing handler that can handle
+//   operation `optag` and passes it the argument `arg`.
+static lh_value yieldop(lh_optag optag, lh_value arg, const fixedargs* fargs)
+{
+  // find the operation handler along the handler stack
+  hstack*   hs = &__hstack;
+  count     skipped;
+  const lh_operation* op;
+  effecthandler* h = hstack_find(hs, optag, &op, &skipped);
+  return yieldop_to(hs, h, op, skipped, arg, fargs);
+}
+
+// Yield back to handler `h` with the result of an `LH_OP_TAIL_NOOP` operation
+// function that was called inline and returned without resuming.
+static lh_value yield_noresume(hstack* hs, effecthandler* h, lh_value res) {
+  #ifdef __cplusplus
+  (void)(hs);
+  yield_to_handler_unwind(h, NULL, res, NULL);  // unwind through destructors on no-resume
+  #else
+  yield_to_handler(hs, h, NULL, NULL, res, NULL, true);
+  #endif
+  assert(false);
+  return lh_value_null;
+}
+
+// Called from `lh_yield_inline` when an `LH_OP_TAIL_NOOP` operation function
+// returned without resuming.
+lh_value _lh_yield_noresume(lh_optag optag, lh_value res) {
+  hstack*   hs = &__hstack;
+  count     skipped;
+  const lh_operation* op;
+  effecthandler* h = hstack_find(hs, optag, &op, &skipped);
+  return yield_noresume(hs, h, res);
+}
+
 // Yield to the first enclosing handler that can handle
 // operation `optag` and pass it the argument `arg`.
 lh_value lh_yield(lh_optag optag, lh_value arg) {
   #ifdef _DEBUG_STATS
   stats.operations++;
   #endif
-  return yieldop(optag, arg);
+  return yieldop(optag, arg, NULL);
+}
+
+// Yield with two to four arguments; these are passed in the handler frame
+// instead of on the C stack so they need no `lh_cstack_ptr` adjustment.
+lh_value lh_yield2(lh_optag optag, lh_value arg1, lh_value arg2) {
+  #ifdef _DEBUG_STATS
+  stats.operations++;
+  #endif
+  fixedargs fargs;
+  assert(offsetof(fixedargs, args) == offsetof(yieldargs, args));
+  fargs.argcount = 2;
+  fargs.args[0] = arg1;
+  fargs.args[1] = arg2;
+  return yieldop(optag, lh_value_any_ptr(&fargs), &fargs);
+}
+
+lh_value lh_yield3(lh_optag optag, lh_value arg1, lh_value arg2, lh_value arg3) {
+  #ifdef _DEBUG_STATS
+  stats.operations++;
+  #endif
+  fixedargs fargs;
+  fargs.argcount = 3;
+  fargs.args[0] = arg1;
+  fargs.args[1] = arg2;
+  fargs.args[2] = arg3;
+  return yieldop(optag, lh_value_any_ptr(&fargs), &fargs);
+}
+
+lh_value lh_yield4(lh_optag optag, lh_value arg1, lh_value arg2, lh_value arg3, lh_value arg4) {
+  #ifdef _DEBUG_STATS
+  stats.operations++;
+  #endif
+  fixedargs fargs;
+  fargs.argcount = 4;
+  fargs.args[0] = arg1;
+  fargs.args[1] = arg2;
+  fargs.args[2] = arg3;
+  fargs.args[3] = arg4;
+  return yieldop(optag, lh_value_any_ptr(&fargs), &fargs);
+}
+
+
+/*-----------------------------------------------------------------
+  Operation bindings
+-----------------------------------------------------------------*/
+
+// Bind an operation to the first enclosing handler that can handle `optag`.
+lh_opbinding lh_bind(lh_optag optag) {
+  hstack*   hs = &__hstack;
+  count     skipped;
+  const lh_operation* op;
+  effecthandler* h = hstack_find(hs, optag, &op, &skipped);
+  lh_opbinding b;
+  b.optag = optag;
+  b.offset = (h == NULL ? -1 : ptrdiff(h, hs->hframes));
+  b.id = (h == NULL ? 0 : h->id);  // identifiers are never 0
+  b.op = op;
+  b.gen = (h == NULL ? -1 : _lh_fastgen);
+  b.local = (h == NULL ? NULL : &h->local);
+  b.opfun = (h == NULL || op->opkind != LH_OP_TAIL_NOOP ? NULL : op->opfun);
+  return b;
+}
+
+#ifndef NDEBUG
+// Is the handler at `offset` still the bound one, and not hidden by a skip region?
+static bool opbinding_valid(const hstack* hs, const lh_opbinding* b) {
+  if (b->offset < 0 || b->offset >= hs->count) return false;
+  const effecthandler* h = (const effecthandler*)(hs->hframes + b->offset);
+  if (!valid_handler(hs, to_handler(h)) || !is_effecthandler(to_handler(h)) || h->id != b->id) return false;
+  if (hstack_tailskip.toskip > 0 && b->offset >= hs->count - hstack_tailskip.toskip) return false;
+  count skip = innermost_skip;
+  const skiphandler* sh;
+  while (skip >= 0 && b->offset < skip - (sh = (const skiphandler*)(hs->hframes + skip))->toskip) {
+    skip = sh->nextskip;
+  }
+  return (skip < 0 || b->offset > skip);
+}
+#endif
+
+// Yield to the handler of a binding directly; called from `lh_yield_bound` if
+// the handler stack changed since the binding was last used.
+lh_value _lh_yield_bound(lh_opbinding* b, lh_value arg) {
+  #ifdef _DEBUG_STATS
+  stats.operations++;
+  #endif
+  hstack* hs = &__hstack;
+  #ifndef NDEBUG
+  if (!opbinding_valid(hs, b)) {
+    fatal(EINVAL, "operation binding for '%s' is used outside the scope of its handler", lh_optag_name(b->optag));
+    return yieldop(b->optag, arg, NULL);
+  }
+  #endif
+  effecthandler* h = (effecthandler*)(hs->hframes + b->offset);
+  b->gen = _lh_fastgen;     // valid until the handler stack changes again
+  b->local = &h->local;
+  return yieldop_to(hs, h, b->op, hs->count - b->offset, arg, NULL);
+}
+
+// An inline bound operation function returned without resuming.
+lh_value _lh_yield_bound_noresume(const lh_opbinding* b, lh_value res) {
+  hstack* hs = &__hstack;
+  return yield_noresume(hs, (effecthandler*)(hs->hframes + b->offset), res);
 }
 
 
@@ -1910,9 +4387,18 @@ lh_value lh_yield_local(lh_optag optag)
 
 // Get a pointer to values passed by stack reference in an operation handler
 void* lh_cstack_ptr(lh_resume r, void* p) {
-  if (r->rkind == TailResume) return p;
+  if (is_tailresume(r) || r->rkind == PromotedResume) return p;  // the stack is still in place
   assert(r->rkind == GeneralResume || r->rkind == ScopedResume);
+  resume_cstack_expand((resume*)r);  // so `p` can be mapped into the captured frames
   cstack* cs = &((resume*)r)->cstack;
+  if (((resume*)r)->sstack != NULL) {
+    // is it pointing into the in-place frames on a separate stack?
+    cstack* ss = &((resume*)r)->sepcstack;
+    if ((const byte*)p >= (const byte*)ss->base && (const byte*)p < (const byte*)ss->base + ss->size) {
+      if (ss->frames == NULL) return p;
+      cs = ss;
+    }
+  }
   ptrdiff_t delta = ptrdiff(cs->frames, cs->base);
   byte* q = (byte*)p + delta;
   assert(q >= cs->frames && q < cs->frames + cs->size);
@@ -1951,7 +4437,7 @@ lh_value lh_yieldN(lh_optag optag, int argcount, ...) {
 
 // Cast to a first class resumption.
 static resume* to_resume(lh_resume r) {
-  if (r->rkind == TailResume) fatal(EINVAL,"Trying to generally resume a tail-resumption");
+  if (is_tailresume(r)) fatal(EINVAL,"Trying to generally resume a tail-resumption");
   return (resume*)r;
 }
 
@@ -1966,7 +4452,10 @@ static __noinline lh_value lh_release_resume_(resume* r, lh_value local, lh_valu
 
 
 lh_value __noinline lh_call_resume(lh_resume r, lh_value local, lh_value res) {
-  return lh_release_resume_(resume_acquire(to_resume(r)), local, res);
+  if (r->rkind == PromotedResume) promoted_capture((resume*)r);
+  resume* rc = to_resume(r);
+  if (promote_threshold > 0) promote_observe(rc, false);
+  return lh_release_resume_(resume_acquire(rc), local, res);
 }
 
 lh_value lh_scoped_resume(lh_resume r, lh_value local, lh_value res) {
@@ -1974,26 +4463,46 @@ lh_value lh_scoped_resume(lh_resume r, lh_value local, lh_value res) {
 }
 
 __noinline lh_value lh_release_resume(lh_resume r, lh_value local, lh_value res) {
+  if (r->rkind == PromotedResume) promoted_capture((resume*)r);
   if (r->rkind == ScopedResume) {
     return lh_scoped_resume(r, local, res);
   }
   else {
-    return lh_release_resume_(to_resume(r), local, res);
+    resume* rc = to_resume(r);
+    if (promote_threshold > 0) promote_observe(rc, false);
+    return lh_release_resume_(rc, local, res);
   }
 }
 
 lh_value lh_tail_resume(lh_resume r, lh_value local, lh_value res) {
-  if (r->rkind == TailResume) {
+  if (is_tailresume(r)) {
     tailresume* tr = (tailresume*)(r);
     tr->resumed = true;
     tr->local = local;
     return res;
   }
-  else if (r->rkind == ScopedResume) {
-    return lh_scoped_resume(r, local, res);
+  else if (r->rkind == PromotedResume) {
+    promotedyield* py = &((resume*)r)->promoted;
+    py->resumed = true;
+    py->local = local;
+    return res;
   }
   else {
-    return lh_release_resume(r, local, res);
+    resume* rc = to_resume(r);
+    if (promote_threshold > 0) promote_observe(rc, true);
+    #ifndef __cplusplus
+    // (in C++ we return through a fragment so exceptions unwind through the operation function)
+    if (resume_is_direct(&__hstack, rc)) {
+      // pop the scoped frame; its reference (or ours if generally resumed) goes to the resumption
+      hstack_pop(&__hstack, false);
+      #ifdef _STATS
+      stats.rcont_elided_fragment++;
+      #endif
+      jumpto_resume(rc, local, res);
+    }
+    #endif
+    if (r->rkind == ScopedResume) rc = resume_acquire(rc);  // like `lh_scoped_resume`
+    return lh_release_resume_(rc, local, res);
   }
 }
 
@@ -2016,7 +4525,12 @@ static void _lh_release(resume* r) {
 }
 
 void __noinline lh_release(lh_resume r) {
-  if (r->rkind != TailResume) _lh_release(to_resume(r));
+  if (r->rkind == PromotedResume) {
+    ((resume*)r)->promoted.released = true;  // so it is not captured when the operation function returns
+  }
+  else if (!is_tailresume(r)) {
+    _lh_release(to_resume(r));
+  }
 }
 
 void lh_nothing() { }
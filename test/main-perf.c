@@ -14,6 +14,16 @@ int main(void)
 {
   printf("benchmark: " LH_CCNAME ", " LH_TARGET "\n");
   perf_counter();  
+  perf_counter_separate();
+  perf_fragments();
+  perf_fragments_shallow();
+  perf_stackcopy();
+  perf_backtrack();
+  perf_parked();
+  perf_depth();
+  perf_request();
+  perf_threads();
+  perf_tailops();
 
   lh_print_stats(stderr);
   tests_check_memory();
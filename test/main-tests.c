@@ -24,6 +24,9 @@ int main(void) {
   test_tailops();
   test_state_alloc();
   test_yieldn();
+  test_sepstack();
+  test_compact();
+  test_profile();
 
   test_exn(); // builtin exceptions
 
@@ -30,6 +30,9 @@ int main(void) {
     test_tailops();
     test_state_alloc();
     test_yieldn();
+    test_sepstack();
+    test_compact();
+    test_profile();
 
     // c++ specific tests with destructors, finalizers etc.  test_destructor();
     test_destructor();
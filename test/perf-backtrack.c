@@ -0,0 +1,121 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016, 2017, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "libhandler.h"
+#include "perf.h"
+
+#ifdef HAS__ALLOCA        // msvc runtime
+# include <malloc.h>
+# define lh_alloca _alloca
+#else
+# include <alloca.h>
+# define lh_alloca alloca
+#endif
+
+/*-----------------------------------------------------------------
+  Backtracking search: count the solutions of the n-queens problem
+  where every `choose` operation resumes once for each choice. The
+  search runs on top of `pad` bytes of stack so each resumption
+  captures a deep stack that mostly stays the same.
+-----------------------------------------------------------------*/
+
+LH_DEFINE_EFFECT1(choice, choose)
+LH_DEFINE_OP1(choice, choose, long, long)
+
+static lh_value _choice_result(lh_value local, lh_value arg) {
+  unreferenced(local);
+  return arg;
+}
+
+static lh_value _choice_choose(lh_resume r, lh_value local, lh_value arg) {
+  long n = lh_long_value(arg);
+  long count = 0;
+  for (long i = 0; i < n - 1; i++) {
+    count += lh_long_value(lh_call_resume(r, local, lh_value_long(i)));
+  }
+  count += lh_long_value(lh_release_resume(r, local, lh_value_long(n - 1)));
+  return lh_value_long(count);
+}
+
+static const lh_operation _choice_ops[] = {
+  { LH_OP_GENERAL, LH_OPTAG(choice,choose), &_choice_choose },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef _choice_def = { LH_EFFECT(choice), NULL, NULL, &_choice_result, _choice_ops };
+
+static bool safe(long col, const long* cols, long row) {
+  for (long r = 0; r < row; r++) {
+    long c = cols[r];
+    if (c == col || c - col == row - r || col - c == row - r) return false;
+  }
+  return true;
+}
+
+static long queens(long n) {
+  long cols[16];
+  for (long row = 0; row < n; row++) {
+    long col = choice_choose(n);
+    if (!safe(col, cols, row)) return 0;
+    cols[row] = col;
+  }
+  return 1;
+}
+
+static lh_value queens_action(lh_value arg) {
+  long n = lh_long_value(arg);
+  size_t pad = (size_t)lh_long_value(lh_yield_local(LH_OPTAG(choice,choose)));
+  volatile char* block = (volatile char*)lh_alloca(pad);
+  block[0] = 0;
+  return lh_value_long(queens(n) + block[0]);
+}
+
+
+/*-----------------------------------------------------------------
+  The same search under a number of tail resumptive handlers that
+  are installed inside the `choice` handler: every resumption then
+  carries a chain of handler frames.
+-----------------------------------------------------------------*/
+
+LH_DEFINE_EFFECT1(cfg, ask)
+
+static lh_value _cfg_ask(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(arg);
+  return lh_tail_resume(r, local, local);
+}
+
+static const lh_operation _cfg_ops[] = {
+  { LH_OP_TAIL_NOOP, LH_OPTAG(cfg,ask), &_cfg_ask },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef _cfg_def = { LH_EFFECT(cfg), NULL, NULL, NULL, _cfg_ops };
+
+// the argument is `16*layers + n`
+static lh_value layered_queens(lh_value arg) {
+  long a = lh_long_value(arg);
+  if (a >= 16) return lh_handle(&_cfg_def, arg, layered_queens, lh_value_long(a - 16));
+  return lh_value_long(queens(a));
+}
+
+static void perf_backtrack_layered() {
+  const long n = 8;
+  for (long layers = 0; layers <= 64; layers = (layers == 0 ? 4 : 4*layers)) {
+    double t0 = start_clock();
+    long solutions = lh_long_value(lh_handle(&_choice_def, lh_value_null, layered_queens, lh_value_long(16*layers + n)));
+    double t = end_clock(t0);
+    printf("backtrack %li-queens under %2li handlers: %6fs, %li solutions\n", n, layers, t, solutions);
+  }
+}
+
+void perf_backtrack() {
+  const long n = 8;
+  for (long pad = 1024; pad <= 64*1024; pad *= 4) {
+    double t0 = start_clock();
+    long solutions = lh_long_value(lh_handle(&_choice_def, lh_value_long(pad), queens_action, lh_value_long(n)));
+    double t = end_clock(t0);
+    printf("backtrack %li-queens on %6li bytes: %6fs, %li solutions\n", n, pad, t, solutions);
+  }
+  perf_backtrack_layered();
+}
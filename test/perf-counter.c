@@ -37,6 +37,19 @@ static int counter_nowork() {
   return sum;
 }
 
+// the same loop with the operations bound to the handler once
+static int counter_nowork_bound() {
+  lh_opbinding get = lh_bind(LH_OPTAG(state,get));
+  lh_opbinding put = lh_bind(LH_OPTAG(state,put));
+  int i;
+  int sum = 0;
+  while ((i = lh_int_value(lh_yield_bound(&get, lh_value_null))) > 0) {
+    sum += i;
+    lh_yield_bound(&put, lh_value_int(i - 1));
+  }
+  return sum;
+}
+
 static int counter() {
   int i;
   int sum = 0;
@@ -57,12 +70,20 @@ static lh_value _counter_nowork(lh_value arg) {
   return lh_value_int(counter_nowork());
 }
 
+static lh_value _counter_nowork_bound(lh_value arg) {
+  unreferenced(arg);
+  return lh_value_int(counter_nowork_bound());
+}
+
 static int counter_eff(int n) {
   return lh_int_value(state_handle(_counter, n, lh_value_null));
 }
 static int counter_eff_nowork(int n) {
   return lh_int_value(state_handle(_counter_nowork, n, lh_value_null));
 }
+static int counter_eff_nowork_bound(int n) {
+  return lh_int_value(state_handle(_counter_nowork_bound, n, lh_value_null));
+}
 
 
 void perf_counter() {
@@ -82,12 +103,85 @@ void perf_counter() {
   int sum2 = counter_eff_nowork(n);
   double t2 = end_clock(t0);
 
+  t0 = start_clock();
+  int sum4 = counter_eff_nowork_bound(n);
+  double t4 = end_clock(t0);
 
   double opsec = (double)(2 * n) / t2;
   printf("native:  %6fs, %i\n", t1, sum1);
   printf("effects: %6fs, %i  (no work)\n", t2, sum2);
+  printf("effects: %6fs, %i  (no work, bound)\n", t4, sum4);
   printf("effects: %6fs, %i\n", t3, sum3);
   printf("summary: n=%i, %.3fx slower, %.3fx slower (work)\n", n, t2 / t1, t3 / t1);
   printf("       : %.3fx sqrt, %.3f million ops/sec\n", ((t3 / t1) - 1.0) / 2.0, opsec/1e6);
 }
 
+
+/*-----------------------------------------------------------------
+  Counter with general operations at a deep stack:
+  compare copying the stack with running on a separate stack
+-----------------------------------------------------------------*/
+
+static const int NGEN = 100000;
+
+static lh_value _gstate_get(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(arg);
+  return lh_tail_resume(r, local, local);
+}
+
+static lh_value _gstate_put(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(local);
+  return lh_tail_resume(r, arg, lh_value_null);
+}
+
+static const lh_operation _gstate_ops[] = {
+  { LH_OP_GENERAL, LH_OPTAG(state,get), &_gstate_get },
+  { LH_OP_GENERAL, LH_OPTAG(state,put), &_gstate_put },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef _gstate_def = { LH_EFFECT(state), NULL, NULL, NULL, _gstate_ops };
+
+// run the counter on top of `depth` frames of about 1kb each
+static int __noinline counter_deep(int depth) {
+  volatile char pad[1024];
+  pad[0] = (char)depth;
+  if (depth > 0) return counter_deep(depth - 1) + pad[0] - (char)depth;
+  return counter_nowork();
+}
+
+static lh_value _counter_deep(lh_value arg) {
+  return lh_value_int(counter_deep(lh_int_value(arg)));
+}
+
+static int counter_general(int n, int depth, bool separate) {
+  lh_value res = (separate ? lh_handle_separate(&_gstate_def, lh_value_int(n), _counter_deep, lh_value_int(depth))
+                           : lh_handle(&_gstate_def, lh_value_int(n), _counter_deep, lh_value_int(depth)));
+  return lh_int_value(res);
+}
+
+void perf_counter_separate() {
+  int n = NGEN;
+  int depths[] = { 0, 4, 32, 128 };
+  for (size_t i = 0; i < sizeof(depths) / sizeof(depths[0]); i++) {
+    int depth = depths[i];
+    counter_general(n / 10, depth, true);  // warm up the separate stack
+
+    double t0 = start_clock();
+    int sum1 = counter_general(n, depth, false);
+    double t1 = end_clock(t0);
+
+    t0 = start_clock();
+    int sum2 = counter_general(n, depth, true);
+    double t2 = end_clock(t0);
+
+    // the general operations always tail resume so they are promoted after a few yields
+    lh_set_op_promote_threshold(16);
+    t0 = start_clock();
+    int sum3 = counter_general(n, depth, false);
+    double t3 = end_clock(t0);
+    lh_set_op_promote_threshold(0);
+
+    printf("general, depth %3ikb: copying: %6fs, %i, separate: %6fs, %i, %.3fx faster\n", depth, t1, sum1, t2, sum2, t1 / t2);
+    printf("                     promoted: %6fs, %i, %.3fx faster\n", t3, sum3, t1 / t3);
+  }
+}
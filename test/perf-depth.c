@@ -0,0 +1,148 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016, 2017, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "libhandler.h"
+#include "perf.h"
+
+/*-----------------------------------------------------------------
+  Yield tail resumptive operations to an outer handler through a
+  varying number of nested handlers (like logging, configuration,
+  exceptions, etc.) that do not handle them.
+-----------------------------------------------------------------*/
+
+LH_DEFINE_EFFECT1(layer, ask)
+LH_DEFINE_OP0(layer, ask, long)
+
+LH_DEFINE_EFFECT2(deep, inc, get)
+LH_DEFINE_VOIDOP0(deep, inc)
+LH_DEFINE_OP0(deep, get, long)
+
+static lh_value _layer_ask(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(arg);
+  return lh_tail_resume(r, local, local);
+}
+
+static const lh_operation _layer_ops[] = {
+  { LH_OP_TAIL_NOOP, LH_OPTAG(layer,ask), &_layer_ask },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef _layer_def = { LH_EFFECT(layer), NULL, NULL, NULL, _layer_ops };
+
+static lh_value _deep_inc(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(arg);
+  return lh_tail_resume(r, lh_value_long(lh_long_value(local) + 1), lh_value_null);
+}
+
+static lh_value _deep_get(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(arg);
+  return lh_tail_resume(r, local, local);
+}
+
+static const lh_operation _deep_ops[] = {
+  { LH_OP_TAIL, LH_OPTAG(deep,inc), &_deep_inc },
+  { LH_OP_TAIL_NOOP, LH_OPTAG(deep,get), &_deep_get },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef _deep_def = { LH_EFFECT(deep), NULL, NULL, NULL, _deep_ops };
+
+LH_DEFINE_EFFECT1(quit, now)
+LH_DEFINE_OP0(quit, now, long)
+
+static lh_value _quit_now(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(r);
+  unreferenced(arg);
+  return local;
+}
+
+static const lh_operation _quit_ops[] = {
+  { LH_OP_NORESUME, LH_OPTAG(quit,now), &_quit_now },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef _quit_def = { LH_EFFECT(quit), NULL, NULL, NULL, _quit_ops };
+
+static const long YIELDS = 1000000;
+
+static lh_value yields_action(lh_value arg) {
+  unreferenced(arg);
+  long sum = 0;
+  for (long i = 0; i < YIELDS; i++) {
+    deep_inc();
+    sum += deep_get();
+  }
+  return lh_value_long(sum);
+}
+
+// every yield happens under a freshly pushed handler
+static lh_value fresh_get(lh_value arg) {
+  unreferenced(arg);
+  return lh_value_long(deep_get());
+}
+
+static lh_value fresh_action(lh_value arg) {
+  unreferenced(arg);
+  long sum = 0;
+  for (long i = 0; i < YIELDS; i++) {
+    deep_inc();
+    sum += lh_long_value(lh_handle(&_layer_def, lh_value_long(i), fresh_get, lh_value_null));
+  }
+  return lh_value_long(sum);
+}
+
+typedef struct _layered {
+  long layers;
+  lh_value(*action)(lh_value);
+} layered;
+
+static lh_value layers_action(lh_value arg) {
+  layered* l = (layered*)lh_ptr_value(arg);
+  if (l->layers > 0) {
+    l->layers--;
+    return lh_handle(&_layer_def, lh_value_long(l->layers), layers_action, arg);
+  }
+  return l->action(lh_value_null);
+}
+
+static void depth_run(const char* name, long layers, lh_value(*action)(lh_value)) {
+  static layered l;   // not on the stack as it is passed as an `lh_value`
+  l.layers = layers;
+  l.action = action;
+  double t0 = start_clock();
+  long sum = lh_long_value(lh_handle(&_deep_def, lh_value_long(0), layers_action, lh_value_ptr(&l)));
+  double t = end_clock(t0);
+  printf("yield %s through %3li handlers: %6fs, %li, %.4f us per yield\n", name, layers, t, sum, (t * 1e6) / (2.0 * YIELDS));
+}
+
+static lh_value quit_action(lh_value arg) {
+  unreferenced(arg);
+  return lh_value_long(quit_now());
+}
+
+// push `layers` handlers and unwind them all with a yield to the outer handler
+static void depth_unwind(long layers) {
+  static layered l;
+  const long n = (1024*1024) / layers;
+  double t0 = start_clock();
+  long sum = 0;
+  for (long i = 0; i < n; i++) {
+    l.layers = layers;
+    l.action = quit_action;
+    sum += lh_long_value(lh_handle(&_quit_def, lh_value_long(1), layers_action, lh_value_ptr(&l)));
+  }
+  double t = end_clock(t0);
+  printf("unwind %3li handlers: %6fs, %li, %.4f us per handler\n", layers, t, sum, (t * 1e6) / (double)(n * layers));
+}
+
+void perf_depth() {
+  for (long layers = 1; layers <= 256; layers *= 4) {
+    depth_run("repeated", layers, yields_action);
+  }
+  for (long layers = 1; layers <= 256; layers *= 4) {
+    depth_run("fresh   ", layers, fresh_action);
+  }
+  for (long layers = 1; layers <= 256; layers *= 4) {
+    depth_unwind(layers);
+  }
+}
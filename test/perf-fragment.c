@@ -0,0 +1,130 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016, 2017, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "libhandler.h"
+#include "perf.h"
+
+/*-----------------------------------------------------------------
+  Yield to an outer handler across many nested fragments.
+  Each `nest` handler resumes its action from within the operation, 
+  which pushes a fragment on the handler stack. The innermost action
+  then yields general operations to the outer `tick` handler which
+  have to unwind (and restore) all the fragments in between.
+-----------------------------------------------------------------*/
+
+LH_DEFINE_EFFECT1(nest, step)
+LH_DEFINE_VOIDOP0(nest, step)
+
+LH_DEFINE_EFFECT1(tick, next)
+LH_DEFINE_OP0(tick, next, long)
+
+static const int TICKS = 100;
+
+static lh_value _nest_step(lh_resume r, lh_value local, lh_value arg) {
+  return lh_release_resume(r, local, arg);
+}
+
+static const lh_operation _nest_ops[] = {
+  { LH_OP_GENERAL, LH_OPTAG(nest,step), &_nest_step },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef _nest_def = { LH_EFFECT(nest), NULL, NULL, NULL, _nest_ops };
+
+static lh_value _tick_next(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(arg);
+  return lh_tail_resume(r, lh_value_long(lh_long_value(local) + 1), local);
+}
+
+static const lh_operation _tick_ops[] = {
+  { LH_OP_GENERAL, LH_OPTAG(tick,next), &_tick_next },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef _tick_def = { LH_EFFECT(tick), NULL, NULL, NULL, _tick_ops };
+
+static lh_value nest_action(lh_value arg) {
+  int level = lh_int_value(arg);
+  nest_step();  // resumed from the operation so a fragment is pushed
+  if (level > 1) {
+    return lh_handle(&_nest_def, lh_value_null, nest_action, lh_value_int(level - 1));
+  }
+  long sum = 0;
+  for (int i = 0; i < TICKS; i++) sum += tick_next();
+  return lh_value_long(sum);
+}
+
+static lh_value nested(lh_value arg) {
+  return lh_handle(&_nest_def, lh_value_null, nest_action, arg);
+}
+
+static long fragments_run(int fragments) {
+  return lh_long_value(lh_handle(&_tick_def, lh_value_long(0), nested, lh_value_int(fragments)));
+}
+
+void perf_fragments() {
+  int n = 1000;
+  for (int fragments = 1; fragments <= 64; fragments *= 2) {
+    fragments_run(fragments);
+    double t0 = start_clock();
+    long sum = 0;
+    for (int i = 0; i < n; i++) sum += fragments_run(fragments);
+    double t = end_clock(t0);
+    printf("unwind %2i fragments: %6fs, %li, %.3f us per yield\n", fragments, t, sum, (t * 1e6) / ((double)n * TICKS));
+  }
+}
+
+
+/*-----------------------------------------------------------------
+  Resume a parked resumption from a shallower stack than where its
+  handler was installed, as in an event loop. The resumed stack then
+  lies above the current stack and no fragment needs to be captured.
+-----------------------------------------------------------------*/
+
+LH_DEFINE_EFFECT1(loop, wait)
+LH_DEFINE_VOIDOP0(loop, wait)
+
+static lh_resume waiting = NULL;
+
+static lh_value _loop_wait(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(local);
+  unreferenced(arg);
+  waiting = r;
+  return lh_value_null;
+}
+
+static const lh_operation _loop_ops[] = {
+  { LH_OP_GENERAL, LH_OPTAG(loop,wait), &_loop_wait },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef _loop_def = { LH_EFFECT(loop), NULL, NULL, NULL, _loop_ops };
+
+static lh_value loop_action(lh_value arg) {
+  long n = lh_long_value(arg);
+  for (long i = 0; i < n; i++) loop_wait();
+  return lh_value_null;
+}
+
+static __noinline long loop_deep(int depth, long n) {
+  volatile char pad[256];
+  pad[0] = (char)depth;
+  if (depth > 0) return loop_deep(depth - 1, n) + pad[0] - depth;
+  lh_handle(&_loop_def, lh_value_null, loop_action, lh_value_long(n));
+  return 0;
+}
+
+void perf_fragments_shallow() {
+  long n = 1000000;
+  loop_deep(16, n);
+  double t0 = start_clock();
+  long count = 0;
+  while (waiting != NULL) {
+    lh_resume r = waiting;
+    waiting = NULL;
+    lh_release_resume(r, lh_value_null, lh_value_null);
+    count++;
+  }
+  double t = end_clock(t0);
+  printf("resume from a shallower stack: %6fs, %li, %.3f us per resume\n", t, count, (t * 1e6) / (double)count);
+}
@@ -0,0 +1,72 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016, 2017, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "libhandler.h"
+#include "perf.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+/*-----------------------------------------------------------------
+  Many parked resumptions, as in an asynchronous server waiting on
+  I/O: measure the memory they use with and without compression.
+-----------------------------------------------------------------*/
+
+LH_DEFINE_EFFECT1(parked, wait)
+LH_DEFINE_OP1(parked, wait, long, long)
+
+static lh_resume* parked;
+
+// the local state is the slot where the resumption is parked
+static lh_value _parked_wait(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(arg);
+  parked[lh_long_value(local)] = r;
+  return lh_value_long(0);
+}
+
+static const lh_operation _parked_ops[] = {
+  { LH_OP_GENERAL, LH_OPTAG(parked,wait), &_parked_wait },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef _parked_def = { LH_EFFECT(parked), NULL, NULL, NULL, _parked_ops };
+
+// a request with a typical frame: some zeroed buffers, pointers, and counters
+static lh_value request_action(lh_value arg) {
+  volatile lh_value buf[128];
+  long id = lh_long_value(arg);
+  for (long i = 0; i < 128; i++) {
+    buf[i] = (i < 64 ? 0 : (i < 96 ? (lh_value)(intptr_t)(&buf[i % 4]) : lh_value_long(id + i)));
+  }
+  long res = parked_wait(id);
+  return lh_value_long(res + (long)buf[127] - id);
+}
+
+static void perf_parked_run(const char* name, size_t threshold, long n) {
+  lh_set_resume_compact_threshold(threshold);
+  long live0 = (long)lh_cstack_live_size();
+  double t0 = start_clock();
+  for (long i = 0; i < n; i++) {
+    lh_handle(&_parked_def, lh_value_long(i), request_action, lh_value_long(i));
+  }
+  double t = end_clock(t0);
+  long live = (long)lh_cstack_live_size() - live0;
+  double t1 = start_clock();
+  long sum = 0;
+  for (long i = 0; i < n; i++) {
+    sum += lh_long_value(lh_release_resume(parked[i], lh_value_long(i), lh_value_long(1)));
+  }
+  double tr = end_clock(t1);
+  printf("parked %s %li: %6fs to park, %6fs to resume, +%li kb (%li bytes each), sum %li\n",
+         name, n, t, tr, live / 1024, live / n, sum);
+  lh_set_resume_compact_threshold(0);
+}
+
+void perf_parked() {
+  const long n = 100000;
+  parked = (lh_resume*)malloc(n * sizeof(lh_resume));
+  perf_parked_run("compressed  ", 1, n);
+  perf_parked_run("uncompressed", 0, n);
+  free(parked);
+}
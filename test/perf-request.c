@@ -0,0 +1,42 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016, 2017, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "libhandler.h"
+#include "perf.h"
+
+/*-----------------------------------------------------------------
+  A service that runs an outermost handler for every request: 
+  compare allocating the handler stack per request with keeping
+  it alive through `lh_thread_init`.
+-----------------------------------------------------------------*/
+
+static lh_value request_action(lh_value arg) {
+  long sum = lh_long_value(arg);
+  for (int i = 0; i < 10; i++) {
+    int x = state_get();
+    sum += x;
+    state_put(x + 1);
+  }
+  return lh_value_long(sum);
+}
+
+static void perf_request_run(const char* name) {
+  const long n = 1000000;
+  double t0 = start_clock();
+  long sum = 0;
+  for (long i = 0; i < n; i++) {
+    sum += lh_long_value(state_handle(request_action, 0, lh_value_long(i % 10)));
+  }
+  double t = end_clock(t0);
+  printf("requests %s: %6fs, %li, %.4f us per request\n", name, t, sum, (t * 1e6) / (double)n);
+}
+
+void perf_request() {
+  perf_request_run("per call  ");
+  lh_thread_init();
+  perf_request_run("persistent");
+  lh_thread_done();
+}
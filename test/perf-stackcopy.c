@@ -0,0 +1,57 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016, 2017, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "libhandler.h"
+#include "perf.h"
+
+#ifdef HAS__ALLOCA        // msvc runtime
+# include <malloc.h>  
+# define lh_alloca _alloca
+#else 
+# include <alloca.h>
+# define lh_alloca alloca
+#endif
+
+/*-----------------------------------------------------------------
+  Capture and restore stacks of a given size: a general operation
+  is yielded on top of a stack allocated block of `size` bytes.
+-----------------------------------------------------------------*/
+
+LH_DEFINE_EFFECT1(capture, now)
+LH_DEFINE_VOIDOP0(capture, now)
+
+static lh_value _capture_now(lh_resume r, lh_value local, lh_value arg) {
+  return lh_tail_resume(r, local, arg);
+}
+
+static const lh_operation _capture_ops[] = {
+  { LH_OP_GENERAL, LH_OPTAG(capture,now), &_capture_now },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef _capture_def = { LH_EFFECT(capture), NULL, NULL, NULL, _capture_ops };
+
+static lh_value capture_action(lh_value arg) {
+  long n = lh_long_value(arg);
+  size_t size = (size_t)lh_long_value(lh_yield_local(LH_OPTAG(capture,now)));
+  volatile char* block = (volatile char*)lh_alloca(size);
+  block[0] = 1;
+  block[size-1] = 1;
+  for (long i = 0; i < n; i++) capture_now();
+  return lh_value_long(block[0] + block[size - 1]);
+}
+
+void perf_stackcopy() {
+  for (long size = 256; size <= 1024*1024; size *= 4) {
+    long n = (1024L * 1024 * 1024) / size;
+    if (n > 100000) n = 100000;
+    lh_handle(&_capture_def, lh_value_long(size), capture_action, lh_value_long(n/10));
+    double t0 = start_clock();
+    lh_handle(&_capture_def, lh_value_long(size), capture_action, lh_value_long(n));
+    double t = end_clock(t0);
+    printf("capture/restore %7li bytes: %6fs, %8.3f us per resume, %8.3f GB/s\n", 
+           size, t, (t * 1e6) / (double)n, (2.0 * (double)size * (double)n) / (t * 1e9));
+  }
+}
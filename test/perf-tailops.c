@@ -0,0 +1,67 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016, 2017, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "libhandler.h"
+#include "perf.h"
+
+/*-----------------------------------------------------------------
+  Tail resumptive operations (`LH_OP_TAIL`) in a tight loop: the
+  handlers from the operation's own handler upward are hidden while
+  the operation function runs, either without any nested operation,
+  or with an operation function that uses the state handler below.
+-----------------------------------------------------------------*/
+
+static const long NTAIL = 10000000;
+
+LH_DEFINE_EFFECT1(ticker, next)
+LH_DEFINE_OP0(ticker, next, long)
+
+static lh_value _ticker_next(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(arg);
+  return lh_tail_resume(r, lh_value_long(lh_long_value(local) + 1), local);
+}
+
+static lh_value _ticker_next_nested(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(arg);
+  int x = state_get();
+  return lh_tail_resume(r, lh_value_long(lh_long_value(local) + x), local);
+}
+
+static const lh_operation _ticker_ops[] = {
+  { LH_OP_TAIL, LH_OPTAG(ticker,next), &_ticker_next },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef _ticker_def = { LH_EFFECT(ticker), NULL, NULL, NULL, _ticker_ops };
+
+static const lh_operation _ticker_nested_ops[] = {
+  { LH_OP_TAIL, LH_OPTAG(ticker,next), &_ticker_next_nested },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef _ticker_nested_def = { LH_EFFECT(ticker), NULL, NULL, NULL, _ticker_nested_ops };
+
+static lh_value ticker_loop(lh_value arg) {
+  long sum = 0;
+  for (long i = 0; i < NTAIL; i++) {
+    sum += ticker_next();
+  }
+  unreferenced(arg);
+  return lh_value_long(sum);
+}
+
+static lh_value ticker_nested_handle(lh_value arg) {
+  return lh_handle(&_ticker_nested_def, lh_value_long(0), ticker_loop, arg);
+}
+
+void perf_tailops() {
+  double t0 = start_clock();
+  long sum1 = lh_long_value(lh_handle(&_ticker_def, lh_value_long(0), ticker_loop, lh_value_null));
+  double t1 = end_clock(t0);
+  t0 = start_clock();
+  long sum2 = lh_long_value(state_handle(ticker_nested_handle, 1, lh_value_null));
+  double t2 = end_clock(t0);
+  printf("tail ops       : %6fs, %li, %.4f us per op\n", t1, sum1, (t1 * 1e6) / (double)NTAIL);
+  printf("tail ops nested: %6fs, %li, %.4f us per op\n", t2, sum2, (t2 * 1e6) / (double)NTAIL);
+}
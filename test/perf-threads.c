@@ -0,0 +1,154 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016, 2017, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+# define _POSIX_C_SOURCE 200112L   // for clock_gettime
+#endif
+#include "libhandler.h"
+#include "perf.h"
+#include <stdint.h>
+
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <pthread.h>
+# include <time.h>
+#endif
+
+/*-----------------------------------------------------------------
+  Install and tear down handlers on a growing number of threads
+  at once; as each thread has its own handler stack and identifiers
+  the time should stay the same as long as there are enough cores.
+-----------------------------------------------------------------*/
+
+LH_DEFINE_EFFECT1(tid, get)
+LH_DEFINE_OP0(tid, get, long)
+
+static lh_value _tid_get(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(arg);
+  return lh_tail_resume(r, local, local);
+}
+
+static const lh_operation _tid_ops[] = {
+  { LH_OP_TAIL_NOOP, LH_OPTAG(tid,get), &_tid_get },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef _tid_def = { LH_EFFECT(tid), NULL, NULL, NULL, _tid_ops };
+
+static const long INSTALLS = 1000000;
+#define MAXTHREADS 8
+
+static lh_value tid_action(lh_value arg) {
+  unreferenced(arg);
+  return lh_value_long(tid_get());
+}
+
+// wall clock time as the process time counts all threads
+static double wall_clock() {
+  #ifdef _WIN32
+  LARGE_INTEGER t, f;
+  QueryPerformanceCounter(&t);
+  QueryPerformanceFrequency(&f);
+  return ((double)t.QuadPart / (double)f.QuadPart);
+  #else
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (double)t.tv_sec + (1.0e-9 * (double)t.tv_nsec);
+  #endif
+}
+
+static long installs_run(long t) {
+  lh_thread_init();
+  long sum = 0;
+  for (long i = 0; i < INSTALLS; i++) {
+    sum += lh_long_value(lh_handle(&_tid_def, lh_value_long(t), tid_action, lh_value_null));
+  }
+  lh_thread_done();
+  return sum;
+}
+
+static long sums[MAXTHREADS];
+
+/*-----------------------------------------------------------------
+  Handler identifiers must be unique over all threads, as
+  bindings compare them to detect a stale handler; each thread
+  records the identifiers of its handlers through `lh_bind`.
+-----------------------------------------------------------------*/
+
+#define IDSAMPLES 1000
+static uint64_t ids[MAXTHREADS * IDSAMPLES];
+
+static lh_value bind_action(lh_value arg) {
+  lh_opbinding b = lh_bind(LH_OPTAG(tid, get));
+  *((uint64_t*)lh_ptr_value(arg)) = b.id;
+  return lh_value_null;
+}
+
+static long ids_run(long t) {
+  lh_thread_init();
+  for (long i = 0; i < IDSAMPLES; i++) {
+    lh_handle(&_tid_def, lh_value_long(t), bind_action, lh_value_ptr(&ids[t * IDSAMPLES + i]));
+  }
+  lh_thread_done();
+  return 0;
+}
+
+static int id_compare(const void* p, const void* q) {
+  const uint64_t x = *((const uint64_t*)p);
+  const uint64_t y = *((const uint64_t*)q);
+  return (x < y ? -1 : (x > y ? 1 : 0));
+}
+
+typedef long (threadfun)(long t);
+static threadfun* thread_run;
+
+#ifdef _WIN32
+static DWORD WINAPI run_thread(LPVOID arg) {
+  long t = (long)(intptr_t)arg;
+  sums[t] = thread_run(t);
+  return 0;
+}
+#else
+static void* run_thread(void* arg) {
+  long t = (long)(intptr_t)arg;
+  sums[t] = thread_run(t);
+  return NULL;
+}
+#endif
+
+static void run_threads(long n, threadfun* run) {
+  thread_run = run;
+  #ifdef _WIN32
+  HANDLE threads[MAXTHREADS];
+  for (long t = 0; t < n; t++) threads[t] = CreateThread(NULL, 0, &run_thread, (LPVOID)(intptr_t)t, 0, NULL);
+  WaitForMultipleObjects((DWORD)n, threads, TRUE, INFINITE);
+  for (long t = 0; t < n; t++) CloseHandle(threads[t]);
+  #else
+  pthread_t threads[MAXTHREADS];
+  for (long t = 0; t < n; t++) pthread_create(&threads[t], NULL, &run_thread, (void*)(intptr_t)t);
+  for (long t = 0; t < n; t++) pthread_join(threads[t], NULL);
+  #endif
+}
+
+void perf_threads() {
+  for (long n = 1; n <= MAXTHREADS; n *= 2) {
+    double t0 = wall_clock();
+    run_threads(n, &installs_run);
+    double t = wall_clock() - t0;
+    long sum = 0;
+    for (long i = 0; i < n; i++) sum += sums[i];
+    printf("handlers installed on %li threads: %6fs, %li, %.4f us per install per thread\n",
+           n, t, sum, (t * 1e6) / (double)INSTALLS);
+  }
+  // check that handler identifiers are unique (and never 0) over all threads
+  run_threads(MAXTHREADS, &ids_run);
+  qsort(ids, MAXTHREADS * IDSAMPLES, sizeof(uint64_t), &id_compare);
+  long dups = 0;
+  for (long i = 0; i < MAXTHREADS * IDSAMPLES; i++) {
+    if (ids[i] == 0 || (i > 0 && ids[i - 1] == ids[i])) dups++;
+  }
+  printf("handler ids on %i threads: %li ids, %li duplicates\n", MAXTHREADS, (long)(MAXTHREADS * IDSAMPLES), dups);
+}
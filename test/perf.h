@@ -27,5 +27,15 @@ double end_clock(double start);
   Performance tests
 -----------------------------------------------------------------*/
 void perf_counter();
+void perf_counter_separate();
+void perf_fragments();
+void perf_fragments_shallow();
+void perf_stackcopy();
+void perf_backtrack();
+void perf_parked();
+void perf_depth();
+void perf_request();
+void perf_threads();
+void perf_tailops();
 
 #endif
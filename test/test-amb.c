@@ -156,6 +156,89 @@ static blist handle_state_amb_foo() {
 }
 
 
+/*-----------------------------------------------------------------
+  Resumptions captured after a resume only store the differences
+  with the stack that was restored (their image). Resume the same
+  resumptions several times while the image changes in between and
+  check that every restored stack still holds its own locals.
+-----------------------------------------------------------------*/
+LH_DEFINE_EFFECT1(pick, choose)
+LH_DEFINE_OP1(pick, choose, long, long)
+
+static long pick_leaves = 0;
+static long pick_errors = 0;
+
+static lh_value _pick_choose(lh_resume rc, lh_value local, lh_value arg) {
+  long n = lh_long_value(arg);
+  long sum = 0;
+  for (long i = 0; i < n - 1; i++) {
+    sum += lh_long_value(lh_call_resume(rc, local, lh_value_long(i)));
+  }
+  sum += lh_long_value(lh_release_resume(rc, local, lh_value_long(n - 1)));
+  return lh_value_long(sum);
+}
+
+static const lh_operation _pick_ops[] = {
+  { LH_OP_GENERAL, LH_OPTAG(pick,choose), &_pick_choose },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef pick_def = { LH_EFFECT(pick), NULL, NULL, NULL, _pick_ops };
+
+static void pick_fill(volatile long* xs, long n, long seed) {
+  for (long i = 0; i < n; i++) xs[i] = 1000*seed + i;
+}
+
+static void pick_check(volatile long* xs, long n, long seed) {
+  for (long i = 0; i < n; i++) {
+    if (xs[i] != 1000*seed + i) pick_errors++;
+  }
+}
+
+static long pick_path(long depth, long path);
+
+// a wide frame that differs from the image: the next capture is a full one
+// and becomes the image of the captures below it
+static long pick_wide(long depth, long path) {
+  volatile long wide[512];
+  pick_fill(wide, 512, path + 1);
+  long res = pick_path(depth, path);
+  pick_check(wide, 512, path + 1);
+  return res;
+}
+
+static long pick_path(long depth, long path) {
+  volatile long locals[32];
+  pick_fill(locals, 32, path + 1);
+  long x = pick_choose(3);
+  pick_check(locals, 32, path + 1);
+  long next = 3*path + x;
+  long res;
+  if (depth <= 1) {
+    pick_leaves++;
+    res = next;
+  }
+  else if (depth == 3) {
+    res = pick_wide(depth - 1, next);
+  }
+  else {
+    res = pick_path(depth - 1, next);
+  }
+  pick_check(locals, 32, path + 1);
+  return res;
+}
+
+static lh_value pick_action(lh_value arg) {
+  return lh_value_long(pick_path(lh_long_value(arg), 0));
+}
+
+static void pick_run() {
+  pick_leaves = 0;
+  pick_errors = 0;
+  long sum = lh_long_value(lh_handle(&pick_def, lh_value_null, pick_action, lh_value_long(4)));
+  test_printf("incremental: %li leaves, sum %li, errors %li\n", pick_leaves, sum, pick_errors);
+}
+
+
 /*-----------------------------------------------------------------
 testing
 -----------------------------------------------------------------*/
@@ -166,6 +249,7 @@ static void run() {
   blist_print("final result state/amb foo", res2); printf("\n");
   blist res3 = handle_amb_state_foo();
   blist_print("final result amb/state foo", res3); printf("\n");
+  pick_run();
 }
 
 
@@ -175,6 +259,7 @@ void test_amb()
     "final result amb xor: [false,true,true,false]\n"
     "final result state/amb foo: [false,false,true,true,false]\n"
     "final result amb/state foo: [false,false]\n"
+    "incremental: 81 leaves, sum 3240, errors 0\n"
   );
 }
 
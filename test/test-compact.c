@@ -0,0 +1,92 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016, 2017, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "libhandler.h"
+#include "tests.h"
+#include <stdint.h>
+
+
+/*-----------------------------------------------------------------
+  parked resumptions with a stack of zeros, pointers, and counters
+-----------------------------------------------------------------*/
+LH_DEFINE_EFFECT1(park, suspend)
+LH_DEFINE_OP1(park, suspend, long, long)
+
+// the local state is the slot where the resumption is stored
+static lh_resume parked[2];
+
+static lh_value _park_suspend(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(arg);
+  parked[lh_long_value(local)] = r;
+  return lh_value_long(-1);
+}
+
+static const lh_operation _park_ops[] = {
+  { LH_OP_GENERAL, LH_OPTAG(park,suspend), &_park_suspend },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef park_def = { LH_EFFECT(park), NULL, NULL, NULL, _park_ops };
+
+static long checksum(const volatile lh_value* buf, long n) {
+  long sum = 0;
+  for (long i = 0; i < n; i++) sum = 31*sum + (long)buf[i];
+  return sum;
+}
+
+static lh_value park_action(lh_value arg) {
+  volatile lh_value buf[300];
+  for (long i = 0; i < 300; i++) {
+    buf[i] = (i < 100 ? 0 : (i < 200 ? (lh_value)(intptr_t)(&buf[i % 7]) : lh_value_long(i * lh_long_value(arg))));
+  }
+  long before = checksum(buf, 300);
+  long y = park_suspend(lh_long_value(arg));
+  return lh_value_long(checksum(buf, 300) == before ? y : -y);
+}
+
+static void resume_parked(int i, long y) {
+  lh_resume r = parked[i];
+  parked[i] = NULL;
+  test_printf("resume %i: %li\n", i, lh_long_value(lh_release_resume(r, lh_value_long(i), lh_value_long(y))));
+}
+
+static lh_value handle_amb_foo_parked(lh_value arg) {
+  return amb_handle(wrap_foo, arg);
+}
+
+
+/*-----------------------------------------------------------------
+  testing
+-----------------------------------------------------------------*/
+static void run() {
+  // explicit compression works without a threshold
+  test_printf("handle 0: %li\n", lh_long_value(lh_handle(&park_def, lh_value_long(0), park_action, lh_value_long(2))));
+  test_printf("handle 1: %li\n", lh_long_value(lh_handle(&park_def, lh_value_long(1), park_action, lh_value_long(3))));
+  test_printf("compact 0: %s\n", lh_resume_compact(parked[0]) ? "true" : "false");
+  test_printf("compact 0 again: %s\n", lh_resume_compact(parked[0]) ? "true" : "false");
+  resume_parked(1, 10);
+  resume_parked(0, 20);
+
+  // compress every general resumption as soon as it is captured
+  lh_set_resume_compact_threshold(1);
+  blist res1 = lh_blist_value(state_handle(handle_amb_foo_parked, 0, lh_value_null));
+  blist_print("compressed state/amb foo", res1);
+  blist res2 = lh_blist_value(amb_handle(wrap_xxor, lh_value_null));
+  blist_print("compressed amb xor", res2);
+  lh_set_resume_compact_threshold(0);
+}
+
+void test_compact() {
+  test("compressed resumptions", run,
+    "handle 0: -1\n"
+    "handle 1: -1\n"
+    "compact 0: true\n"
+    "compact 0 again: false\n"
+    "resume 1: 10\n"
+    "resume 0: 20\n"
+    "compressed state/amb foo: [false,false,true,true,false]\n"
+    "compressed amb xor: [false,true,true,false]\n"
+  );
+}
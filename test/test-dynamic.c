@@ -204,6 +204,38 @@ static lh_value test_dyn4() {
   return showBY_handle(test_resume1, rc);
 }
 
+// a handler definition at an address that is reused for other definitions
+static lh_handlerdef reused_def;
+
+static lh_value test_showB(lh_value arg) {
+  unreferenced(arg);
+  B_showB();
+  return lh_value_int(1);
+}
+
+static lh_value test_showA(lh_value arg) {
+  unreferenced(arg);
+  A_showA(false);
+  return lh_value_int(1);
+}
+
+// run under an outer handler so the analysis of the definitions is kept in between
+static lh_value test_reused_action(lh_value arg) {
+  unreferenced(arg);
+  reused_def = showB_def;
+  int x = lh_int_value(lh_handle(&reused_def, lh_value_null, test_showB, lh_value_null));
+  reused_def = showBY_def;
+  int y = lh_int_value(lh_handle(&reused_def, lh_value_null, test_showB, lh_value_null));
+  reused_def = showA_def;
+  int z = lh_int_value(lh_handle(&reused_def, lh_value_null, test_showA, lh_value_null));
+  test_printf("test reused: %i, %i, %i\n", x, y, z);
+  return lh_value_null;
+}
+
+static void test_reused() {
+  showBX_handle(test_reused_action, lh_value_null);
+}
+
 static void run() {
   lh_value res1 = test_dyn1();
   test_printf("test dyn1: %i\n", lh_int_value(res1));
@@ -213,6 +245,7 @@ static void run() {
   test_printf("test dyn3: %i\n", lh_int_value(res3));
   lh_value res4 = test_dyn4();
   test_printf("test dyn4: %i\n", lh_int_value(res4));
+  test_reused();
 
 }
 
@@ -222,5 +255,6 @@ void test_dynamic() {
     "test dyn2: 42\n"
     "test dyn3: 42\n"
     "test dyn4: 43\n"
+    "test reused: 1, 43, 42\n"
   );
 }
@@ -61,6 +61,131 @@ static blist handle_state_amb_foo() {
 }
 
 
+/*-----------------------------------------------------------------
+  resume from a shallower stack than where the handler was installed
+-----------------------------------------------------------------*/
+LH_DEFINE_EFFECT1(event, await)
+LH_DEFINE_OP0(event, await, long)
+
+static lh_resume awaiting = NULL;
+
+static lh_value _event_await(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(local);
+  unreferenced(arg);
+  awaiting = r;
+  return lh_value_long(-1);
+}
+
+static const lh_operation _event_ops[] = {
+  { LH_OP_GENERAL, LH_OPTAG(event,await), &_event_await },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef event_def = { LH_EFFECT(event), NULL, NULL, NULL, _event_ops };
+
+static lh_value event_action(lh_value arg) {
+  long sum = lh_long_value(arg);
+  for (int i = 0; i < 3; i++) sum += event_await();
+  trace_printf("event sum: %li\n", sum);
+  return lh_value_long(sum);
+}
+
+static long event_deep(int depth) {
+  volatile char pad[256];
+  pad[0] = (char)depth;
+  if (depth > 0) return event_deep(depth - 1) + pad[0] - depth;
+  return lh_long_value(lh_handle(&event_def, lh_value_null, event_action, lh_value_long(100)));
+}
+
+static void event_loop() {
+  long res = event_deep(8);
+  int i = 1;
+  while (awaiting != NULL) {
+    lh_resume r = awaiting;
+    awaiting = NULL;
+    res = lh_long_value(lh_release_resume(r, lh_value_null, lh_value_long(i++)));
+  }
+  test_printf("event loop: %li\n", res);
+}
+
+
+/*-----------------------------------------------------------------
+  promote general operations that turn out to tail resume
+-----------------------------------------------------------------*/
+LH_DEFINE_EFFECT1(promo, next)
+LH_DEFINE_OP1(promo, next, long, long)
+
+// tail resumes, except for negative arguments
+static lh_value _promo_next(lh_resume r, lh_value local, lh_value arg) {
+  long x = lh_long_value(arg);
+  if (x >= 0) return lh_tail_resume(r, local, lh_value_long(x + 1));
+  return lh_call_resume(r, local, lh_value_long(-x));
+}
+
+static const lh_operation _promo_ops[] = {
+  { LH_OP_GENERAL, LH_OPTAG(promo,next), &_promo_next },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef promo_def = { LH_EFFECT(promo), NULL, NULL, NULL, _promo_ops };
+
+static lh_value promo_action(lh_value arg) {
+  long sum = 0;
+  for (long i = 0; i < 20; i++) sum += promo_next(i);
+  sum += 1000*promo_next(-lh_long_value(arg));
+  for (long i = 0; i < 5; i++) sum += promo_next(i);
+  return lh_value_long(sum);
+}
+
+static long promo_captures() {
+  lh_capture_stats entries[8];
+  size_t n = lh_capture_profile(entries, 8);
+  for (size_t i = 0; i < n; i++) {
+    if (entries[i].optag == LH_OPTAG(promo,next)) return entries[i].captures;
+  }
+  return 0;
+}
+
+static void promo_run(size_t threshold) {
+  lh_set_op_promote_threshold(threshold);
+  lh_capture_profile_enable(true);
+  long res = lh_long_value(lh_handle(&promo_def, lh_value_null, promo_action, lh_value_long(7)));
+  long captures = promo_captures();
+  lh_capture_profile_enable(false);
+  lh_capture_profile_reset();
+  blist res2 = lh_blist_value(multi_state_handle(handle_amb_foo, lh_value_null));
+  lh_set_op_promote_threshold(0);
+  test_printf("promote after %i: %li, captures %li\n", (int)threshold, res, captures);
+  blist_print("promoted multi-state/amb foo", res2); printf("\n");
+}
+
+// a promoted operation that parks its resumption after all, for negative arguments
+static lh_resume parked = NULL;
+
+static lh_value _park_next(lh_resume r, lh_value local, lh_value arg) {
+  long x = lh_long_value(arg);
+  if (x >= 0) return lh_tail_resume(r, local, lh_value_long(x + 1));
+  parked = r;
+  return lh_value_long(x);
+}
+
+static const lh_operation _park_ops[] = {
+  { LH_OP_GENERAL, LH_OPTAG(promo,next), &_park_next },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef park_def = { LH_EFFECT(promo), NULL, NULL, NULL, _park_ops };
+
+static void promo_parked(size_t threshold) {
+  lh_set_op_promote_threshold(threshold);
+  long first = lh_long_value(lh_handle(&park_def, lh_value_null, promo_action, lh_value_long(7)));
+  long res = 0;
+  while (parked != NULL) {
+    lh_resume r = parked;
+    parked = NULL;
+    res = lh_long_value(lh_release_resume(r, lh_value_null, lh_value_long(7)));
+  }
+  lh_set_op_promote_threshold(0);
+  test_printf("parked after %i: %li, resumed %li\n", (int)threshold, first, res);
+}
+
 /*-----------------------------------------------------------------
 testing
 -----------------------------------------------------------------*/
@@ -70,11 +195,23 @@ static void run()
   blist_print("final result multi-state/amb foo", res2); printf("\n");
   blist res3 = handle_amb_state_foo();
   blist_print("final result amb/multi-state foo", res3); printf("\n");
+  event_loop();
+  promo_run(0);
+  promo_run(4);
+  promo_parked(0);
+  promo_parked(4);
 }
 
 void test_general() {
   test("general resume", run, 
     "final result multi-state/amb foo: [false,false,true,true,false]\n"
     "final result amb/multi-state foo: [false,false]\n"
+    "event loop: 106\n"
+    "promote after 0: 7225, captures 26\n"
+    "promoted multi-state/amb foo: [false,false,true,true,false]\n"
+    "promote after 4: 7225, captures 10\n"
+    "promoted multi-state/amb foo: [false,false,true,true,false]\n"
+    "parked after 0: -7, resumed 7225\n"
+    "parked after 4: -7, resumed 7225\n"
   );
 }
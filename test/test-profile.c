@@ -0,0 +1,57 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016, 2017, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "libhandler.h"
+#include "tests.h"
+
+
+/*-----------------------------------------------------------------
+  profile the captured stacks of amb and state operations
+-----------------------------------------------------------------*/
+
+// print the operation with the largest copy volume
+static void profile_print() {
+  lh_capture_stats entries[4];
+  size_t n = lh_capture_profile(entries, 4);
+  test_printf("profiled operations: %i\n", (int)n);
+  if (n == 0) return;
+  const lh_capture_stats* e = &entries[0];
+  test_printf("%s: captures %li, resumes %li, %s\n", lh_optag_name(e->optag), e->captures, e->resumes,
+    (e->captured_size > 0 && e->captured_max <= e->captured_size ? "captured" : "empty"));
+}
+
+
+/*-----------------------------------------------------------------
+  testing
+-----------------------------------------------------------------*/
+static void run() {
+  lh_capture_profile_enable(true);
+  blist res1 = lh_blist_value(amb_handle(wrap_xxor, lh_value_null));
+  blist_print("amb xor", res1);
+  profile_print();
+  lh_capture_profile_reset();
+  blist res2 = lh_blist_value(multi_state_handle(handle_amb_foo, lh_value_null));
+  blist_print("multi-state/amb foo", res2);
+  profile_print();
+  lh_capture_profile_enable(false);
+  lh_capture_profile_reset();
+  blist res3 = lh_blist_value(amb_handle(wrap_xxor, lh_value_null));
+  blist_print("amb xor", res3);
+  profile_print();
+}
+
+void test_profile() {
+  test("capture profile", run,
+    "amb xor: [false,true,true,false]\n"
+    "profiled operations: 1\n"
+    "amb/flip: captures 3, resumes 6, captured\n"
+    "multi-state/amb foo: [false,false,true,true,false]\n"
+    "profiled operations: 3\n"
+    "amb/flip: captures 4, resumes 8, captured\n"
+    "amb xor: [false,true,true,false]\n"
+    "profiled operations: 0\n"
+  );
+}
@@ -0,0 +1,158 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016, 2017, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "libhandler.h"
+#include "tests.h"
+
+
+/*-----------------------------------------------------------------
+  ambiguity handler on a separate stack
+-----------------------------------------------------------------*/
+
+static lh_value _amb_result(lh_value local, lh_value arg) {
+  unreferenced(local);
+  return lh_value_blist(blist_single(lh_bool_value(arg)));
+}
+
+static lh_value _amb_flip(lh_resume rc, lh_value local, lh_value arg) {
+  unreferenced(arg);
+  blist xs = lh_blist_value(lh_call_resume(rc, local, lh_value_bool(false)));
+  blist ys = lh_blist_value(lh_release_resume(rc, local, lh_value_bool(true)));
+  blist_appendto(xs, ys);
+  return lh_value_blist(xs);
+}
+
+static const lh_operation _amb_ops[] = {
+  { LH_OP_GENERAL, LH_OPTAG(amb,flip), &_amb_flip },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef amb_def = { LH_EFFECT(amb), NULL, NULL, &_amb_result, _amb_ops };
+
+static lh_value amb_handle_separate(lh_value(*action)(lh_value), lh_value arg) {
+  return lh_handle_separate(&amb_def, lh_value_null, action, arg);
+}
+
+static lh_value handle_amb_foo_separate(lh_value arg) {
+  return amb_handle_separate(wrap_foo, arg);
+}
+
+static lh_value handle_state_foo(lh_value arg) {
+  return state_handle(wrap_foo, 0, arg);
+}
+
+static lh_value handle_multi_state_foo(lh_value arg) {
+  return multi_state_handle(wrap_foo, arg);
+}
+
+
+/*-----------------------------------------------------------------
+  a counter deep in the separate stack
+-----------------------------------------------------------------*/
+LH_DEFINE_EFFECT1(sep, next)
+LH_DEFINE_OP0(sep, next, long)
+
+static lh_value _sep_next(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(arg);
+  long i = lh_long_value(local);
+  return lh_tail_resume(r, lh_value_long(i + 1), lh_value_long(i));
+}
+
+static const lh_operation _sep_ops[] = {
+  { LH_OP_GENERAL, LH_OPTAG(sep,next), &_sep_next },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef sep_def = { LH_EFFECT(sep), NULL, NULL, NULL, _sep_ops };
+
+static long deep_sum(int depth, int n) {
+  volatile char pad[256];
+  pad[0] = (char)depth;
+  if (depth > 0) return deep_sum(depth - 1, n) + pad[0] - depth;
+  long sum = 0;
+  for (int i = 0; i < n; i++) sum += sep_next();
+  return sum;
+}
+
+static lh_value deep_action(lh_value arg) {
+  return lh_value_long(deep_sum((int)lh_long_value(arg), 100));
+}
+
+
+/*-----------------------------------------------------------------
+  resumptions that are resumed after the handler returned
+-----------------------------------------------------------------*/
+LH_DEFINE_EFFECT1(later, suspend)
+LH_DEFINE_OP1(later, suspend, long, long)
+
+// the local state is the slot where the resumption is stored
+static lh_resume suspended[2];
+
+static lh_value _later_suspend(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(arg);
+  suspended[lh_long_value(local)] = r;
+  return lh_value_long(-1);
+}
+
+static const lh_operation _later_ops[] = {
+  { LH_OP_GENERAL, LH_OPTAG(later,suspend), &_later_suspend },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef later_def = { LH_EFFECT(later), NULL, NULL, NULL, _later_ops };
+
+static lh_value later_action(lh_value arg) {
+  long x = lh_long_value(arg);
+  long y = later_suspend(x);
+  return lh_value_long(x*y + later_suspend(y));
+}
+
+static void resume_later(int i, long y) {
+  lh_resume r = suspended[i];
+  suspended[i] = NULL;
+  test_printf("resume %i: %li\n", i, lh_long_value(lh_release_resume(r, lh_value_long(i), lh_value_long(y))));
+}
+
+
+/*-----------------------------------------------------------------
+  testing
+-----------------------------------------------------------------*/
+static void run() {
+  blist res1 = lh_blist_value(amb_handle_separate(wrap_xxor, lh_value_null));
+  blist_print("separate amb xor", res1);
+  blist res2 = lh_blist_value(state_handle(handle_amb_foo_separate, 0, lh_value_null));
+  blist_print("separate state/amb foo", res2);
+  blist res3 = lh_blist_value(amb_handle_separate(handle_state_foo, lh_value_null));
+  blist_print("separate amb/state foo", res3);
+  blist res4 = lh_blist_value(multi_state_handle(handle_amb_foo_separate, lh_value_null));
+  blist_print("separate multi-state/amb foo", res4);
+  blist res5 = lh_blist_value(amb_handle_separate(handle_multi_state_foo, lh_value_null));
+  blist_print("separate amb/multi-state foo", res5);
+
+  long sum = lh_long_value(lh_handle_separate(&sep_def, lh_value_long(1), deep_action, lh_value_long(100)));
+  test_printf("separate deep sum: %li\n", sum);
+
+  test_printf("handle 0: %li\n", lh_long_value(lh_handle_separate(&later_def, lh_value_long(0), later_action, lh_value_long(2))));
+  test_printf("handle 1: %li\n", lh_long_value(lh_handle_separate(&later_def, lh_value_long(1), later_action, lh_value_long(3))));
+  resume_later(1, 10);
+  resume_later(0, 20);
+  resume_later(0, 5);
+  resume_later(1, 7);
+}
+
+void test_sepstack() {
+  test("separate stacks", run,
+    "separate amb xor: [false,true,true,false]\n"
+    "separate state/amb foo: [false,false,true,true,false]\n"
+    "separate amb/state foo: [false,false]\n"
+    "separate multi-state/amb foo: [false,false,true,true,false]\n"
+    "separate amb/multi-state foo: [false,false]\n"
+    "separate deep sum: 5050\n"
+    "handle 0: -1\n"
+    "handle 1: -1\n"
+    "resume 1: -1\n"
+    "resume 0: -1\n"
+    "resume 0: 45\n"
+    "resume 1: 37\n"
+  );
+}
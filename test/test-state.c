@@ -13,8 +13,8 @@ found in the file "license.txt" at the root of this distribution.
 -----------------------------------------------------------------*/
 LH_DEFINE_EFFECT2(state, get, put)
 
-LH_DEFINE_OP0(state, get, int)
-LH_DEFINE_VOIDOP1(state, put, int)
+LH_DEFINE_INLINE_OP0(state, get, int)
+LH_DEFINE_INLINE_VOIDOP1(state, put, int)
 
 
 
@@ -91,12 +91,65 @@ lh_value state_handle(lh_value(*action)(lh_value), int state0, lh_value arg) {
 
 
 
+// a burst of nested handlers that grows the handler stack
+static lh_value state_burst(lh_value arg) {
+  int n = lh_int_value(arg);
+  if (n == 0) return lh_value_int(state_get());
+  return state_handle(state_burst, n, lh_value_int(n - 1));
+}
+
+// growing the handler stack while the handler is active moves its frame
+static lh_value state_reserve(lh_value arg) {
+  int i = state_get();
+  lh_hstack_reserve((size_t)lh_int_value(arg));
+  state_put(i + 1);
+  return lh_value_int(state_get());
+}
+
+// operations bound once to the handler; an inner handler does not capture them
+static lh_value state_bound_inner(lh_value arg) {
+  lh_opbinding* put = (lh_opbinding*)lh_ptr_value(arg);
+  lh_yield_bound(put, lh_value_int(state_get() + 1));
+  return lh_value_null;
+}
+
+static lh_value state_bound(lh_value arg) {
+  unreferenced(arg);
+  lh_opbinding get = lh_bind(LH_OPTAG(state,get));
+  lh_opbinding put = lh_bind(LH_OPTAG(state,put));
+  int sum = 0;
+  int i;
+  while ((i = lh_int_value(lh_yield_bound(&get, lh_value_null))) > 0) {
+    sum += i;
+    lh_yield_bound(&put, lh_value_int(i - 1));
+  }
+  state_handle(state_bound_inner, 100, lh_value_any_ptr(&put));
+  return lh_value_int(sum + 1000*state_get());
+}
+
 /*-----------------------------------------------------------------
 testing
 -----------------------------------------------------------------*/
 static void run() {
   lh_value res1 = state_handle(state_counter,2,lh_value_null);
   test_printf("final result counter: %i\n", lh_int_value(res1));
+  // keep the handler stack alive across outermost handlers
+  lh_thread_init();
+  lh_value res2 = state_handle(state_counter,2,lh_value_null);
+  lh_value res3 = state_handle(state_counter,3,lh_value_null);
+  lh_thread_done();
+  test_printf("persistent counters: %i, %i\n", lh_int_value(res2), lh_int_value(res3));
+  // shrink the handler stack again after a burst
+  lh_hstack_reserve(16*1024);
+  lh_set_hstack_shrink(64*1024);
+  lh_value res4 = state_handle(state_burst, 0, lh_value_int(2000));
+  lh_value res5 = state_handle(state_counter, 2, lh_value_null);
+  lh_value res6 = state_handle(state_reserve, 5, lh_value_int(1024*1024));
+  lh_set_hstack_shrink(256*1024);
+  lh_thread_done();
+  test_printf("burst: %i, counter: %i, reserve: %i\n", lh_int_value(res4), lh_int_value(res5), lh_int_value(res6));
+  lh_value res7 = state_handle(state_bound, 3, lh_value_null);
+  test_printf("bound: %i\n", lh_int_value(res7));
 }
 
 
@@ -104,6 +157,9 @@ void test_state()
 {
   test("state", run,
     "final result counter: 42\n"
+    "persistent counters: 42, 42\n"
+    "burst: 1, counter: 42, reserve: 6\n"
+    "bound: 101006\n"
   );
 }
 
@@ -46,9 +46,201 @@ lh_value excn_tr_handle_test(lh_value arg) {
   return excn_handle(tr_handle_test, arg);
 }
 
+
+/*-----------------------------------------------------------------
+  Tail resume operations that yield themselves: the skip frames
+  hide nested regions of the handler stack
+-----------------------------------------------------------------*/
+LH_DEFINE_EFFECT1(lvl, ask)
+LH_DEFINE_OP0(lvl, ask, long)
+
+LH_DEFINE_EFFECT1(ctr, next)
+LH_DEFINE_OP0(ctr, next, long)
+
+static lh_value _ctr_next(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(arg);
+  return lh_tail_resume(r, lh_value_long(lh_long_value(local) + 1), local);
+}
+
+static const lh_operation _ctr_ops[] = {
+  { LH_OP_TAIL, LH_OPTAG(ctr,next), &_ctr_next },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef ctr_def = { LH_EFFECT(ctr), NULL, NULL, NULL, _ctr_ops };
+
+// the inner `lvl` handler asks the outer one; the outer one skips the inner `ctr` handler
+static lh_value _lvl_ask(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(arg);
+  long level = lh_long_value(local);
+  long res = (level == 2 ? 100*level + ctr_next() + lvl_ask() : 10*level + ctr_next());
+  return lh_tail_resume(r, local, lh_value_long(res));
+}
+
+static const lh_operation _lvl_ops[] = {
+  { LH_OP_TAIL, LH_OPTAG(lvl,ask), &_lvl_ask },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef lvl_def = { LH_EFFECT(lvl), NULL, NULL, NULL, _lvl_ops };
+
+static lh_value skip_action(lh_value arg) {
+  unreferenced(arg);
+  long x = lvl_ask();
+  long y = ctr_next();
+  test_printf("skip regions: %li, %li\n", x, y);
+  return lh_value_long(x + y);
+}
+
+static lh_value skip_inner_lvl(lh_value arg) {
+  return lh_handle(&lvl_def, lh_value_long(2), skip_action, arg);
+}
+
+static lh_value skip_inner_ctr(lh_value arg) {
+  return lh_handle(&ctr_def, lh_value_long(500), skip_inner_lvl, arg);
+}
+
+static lh_value skip_outer_lvl(lh_value arg) {
+  return lh_handle(&lvl_def, lh_value_long(1), skip_inner_ctr, arg);
+}
+
+static lh_value skip_handle_test(lh_value arg) {
+  return lh_handle(&ctr_def, lh_value_long(1000), skip_outer_lvl, arg);
+}
+
+
+// operation functions that capture a resumption or install a handler
+LH_DEFINE_EFFECT1(twice, fork)
+LH_DEFINE_OP0(twice, fork, long)
+
+static lh_value _twice_fork(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(arg);
+  long x = lh_long_value(lh_call_resume(r, local, lh_value_long(1)));
+  long y = lh_long_value(lh_release_resume(r, local, lh_value_long(2)));
+  return lh_value_long(x + y);
+}
+
+static const lh_operation _twice_ops[] = {
+  { LH_OP_GENERAL, LH_OPTAG(twice,fork), &_twice_fork },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef twice_def = { LH_EFFECT(twice), NULL, NULL, NULL, _twice_ops };
+
+static lh_value ctr_first(lh_value arg) {
+  unreferenced(arg);
+  return lh_value_long(ctr_next());
+}
+
+static lh_value _lvl_ask_fork(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(arg);
+  long x = twice_fork();
+  long y = lh_long_value(lh_handle(&ctr_def, lh_value_long(10*x), ctr_first, lh_value_null));
+  long z = ctr_next();
+  return lh_tail_resume(r, local, lh_value_long(100*x + y + z));
+}
+
+static const lh_operation _lvl_fork_ops[] = {
+  { LH_OP_TAIL, LH_OPTAG(lvl,ask), &_lvl_ask_fork },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef lvl_fork_def = { LH_EFFECT(lvl), NULL, NULL, NULL, _lvl_fork_ops };
+
+static lh_value fork_action(lh_value arg) {
+  unreferenced(arg);
+  long x = lvl_ask();
+  long y = ctr_next();
+  return lh_value_long(x + y);
+}
+
+static lh_value fork_inner_ctr(lh_value arg) {
+  return lh_handle(&ctr_def, lh_value_long(500), fork_action, arg);
+}
+
+static lh_value fork_lvl(lh_value arg) {
+  return lh_handle(&lvl_fork_def, lh_value_null, fork_inner_ctr, arg);
+}
+
+static lh_value fork_outer_ctr(lh_value arg) {
+  return lh_handle(&ctr_def, lh_value_long(1000), fork_lvl, arg);
+}
+
+static long fork_handle_test() {
+  return lh_long_value(lh_handle(&twice_def, lh_value_null, fork_outer_ctr, lh_value_null));
+}
+
+
+/*-----------------------------------------------------------------
+  Tail resume operations that return without resuming: the
+  handler returns directly, unwinding any inner handlers
+-----------------------------------------------------------------*/
+LH_DEFINE_EFFECT1(chk, check)
+LH_DEFINE_OP1(chk, check, long, long)
+
+static lh_value _chk_check(lh_resume r, lh_value local, lh_value arg) {
+  long x = lh_long_value(arg);
+  if (x < 0) return lh_value_long(10*x);  // no resume
+  return lh_tail_resume(r, local, arg);
+}
+
+static const lh_operation _chk_ops[] = {
+  { LH_OP_TAIL, LH_OPTAG(chk,check), &_chk_check },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef chk_def = { LH_EFFECT(chk), NULL, NULL, NULL, _chk_ops };
+
+static lh_value chk_action(lh_value arg) {
+  long sum = 0;
+  for (long i = lh_long_value(arg); i > -10; i--) {
+    sum += chk_check(i) + ctr_next();
+  }
+  return lh_value_long(sum);
+}
+
+static lh_value chk_inner_ctr(lh_value arg) {
+  return lh_handle(&ctr_def, lh_value_long(0), chk_action, arg);
+}
+
+static long chk_handle_test(long n) {
+  return lh_long_value(lh_handle(&chk_def, lh_value_null, chk_inner_ctr, lh_value_long(n)));
+}
+
+
+// the same with an inline operation that is called directly once it was found
+LH_DEFINE_EFFECT1(chkn, check)
+LH_DEFINE_INLINE_OP1(chkn, check, long, long)
+
+static const lh_operation _chkn_ops[] = {
+  { LH_OP_TAIL_NOOP, LH_OPTAG(chkn,check), &_chk_check },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef chkn_def = { LH_EFFECT(chkn), NULL, NULL, NULL, _chkn_ops };
+
+static lh_value chkn_action(lh_value arg) {
+  long sum = 0;
+  for (long i = lh_long_value(arg); i > -10; i--) {
+    sum += chkn_check(i);
+  }
+  return lh_value_long(sum);
+}
+
+static lh_value chkn_inner_ctr(lh_value arg) {
+  return lh_handle(&ctr_def, lh_value_long(0), chkn_action, arg);
+}
+
+static long chkn_handle_test(long n) {
+  return lh_long_value(lh_handle(&chkn_def, lh_value_null, chkn_inner_ctr, lh_value_long(n)));
+}
+
 static void run() {
   lh_value res1 = excn_tr_handle_test(lh_value_long(42));
   test_printf("test res1: %li\n", lh_long_value(res1));
+  lh_value res2 = skip_handle_test(lh_value_null);
+  test_printf("test res2: %li\n", lh_long_value(res2));
+  test_printf("captured in skip region: %li\n", fork_handle_test());
+  long res3 = chk_handle_test(3);
+  long res4 = chk_handle_test(3) + chk_handle_test(-5);
+  test_printf("no resume: %li, %li\n", res3, res4);
+  long res5 = chkn_handle_test(3);
+  long res6 = chkn_handle_test(3) + chkn_handle_test(-5);
+  test_printf("inline no resume: %li, %li\n", res5, res6);
 }
 
 void test_tailops() {
@@ -56,5 +248,10 @@ void test_tailops() {
     "tail-raise called: 42\n"
     "exception raised: an error message from 'id_raise'\n"
     "test res1: 0\n"
+    "skip regions: 1710, 501\n"
+    "test res2: 2211\n"
+    "captured in skip region: 3330\n"
+    "no resume: -10, -60\n"
+    "inline no resume: -10, -60\n"
   );
 }
@@ -122,6 +122,57 @@ static lh_value a_handle_test3() {
   return a_handle3(&test1, lh_value_int(42));
 }
 
+/*-----------------------------------------------------------------
+  test that an exception from a promoted operation is raised at
+  the handler and not inside the action
+-----------------------------------------------------------------*/
+
+LH_DEFINE_EFFECT1(b,bar)
+LH_DEFINE_OP1(b,bar,long,long)
+
+static lh_value test4(lh_value arg) {
+  TestDestructor t("test4");
+  long sum = 0;
+  for (long i = lh_long_value(arg); i >= 0; i--) {
+    try {
+      sum += b_bar(i);
+    }
+    catch (const char* msg) {
+      test_printf("exception caught in action: %s\n", msg);
+    }
+  }
+  return lh_value_long(sum);
+}
+
+static lh_value handle_b_bar(lh_resume r, lh_value local, lh_value arg) {
+  long i = lh_long_value(arg);
+  if (i > 0) return lh_tail_resume(r, local, arg);
+  if (lh_long_value(local) != 0) {
+    // capture the resumption first
+    test_printf("resumed: %li\n", lh_long_value(lh_call_resume(r, local, arg)));
+  }
+  throw "exception from operation";
+}
+
+static const lh_operation _b_ops[] = {
+  { LH_OP_SCOPED, LH_OPTAG(b,bar), &handle_b_bar },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef _b_def = { LH_EFFECT(b), NULL, NULL, NULL, _b_ops };
+
+static long b_handle_test4(size_t threshold, bool resume) {
+  lh_set_op_promote_threshold(threshold);
+  long res = -1;
+  try {
+    res = lh_long_value(lh_handle(&_b_def, lh_value_bool(resume), test4, lh_value_long(8)));
+  }
+  catch (const char* msg) {
+    test_printf("exception caught at handler: %s\n", msg);
+  }
+  lh_set_op_promote_threshold(0);
+  return res;
+}
+
 /*-----------------------------------------------------------------
 
 -----------------------------------------------------------------*/
@@ -133,6 +184,9 @@ static void run() {
   test_printf("test try2: %li\n", lh_long_value(res2));
   lh_value res3 = a_handle_test3();
   test_printf("test try3: %li\n", lh_long_value(res3));
+  test_printf("test try4 after 0: %li\n", b_handle_test4(0, false));
+  test_printf("test try4 after 4: %li\n", b_handle_test4(4, false));
+  test_printf("test try4 resume after 4: %li\n", b_handle_test4(4, true));
 }
 
 void test_try() {
@@ -147,5 +201,13 @@ void test_try() {
     "test try2: 42\n"
     "destructor called: test1\n"
     "test try3: 42\n"
+    "exception caught at handler: exception from operation\n"
+    "test try4 after 0: -1\n"
+    "exception caught at handler: exception from operation\n"
+    "test try4 after 4: -1\n"
+    "destructor called: test4\n"
+    "resumed: 36\n"
+    "exception caught at handler: exception from operation\n"
+    "test try4 resume after 4: -1\n"
   );
 }
\ No newline at end of file
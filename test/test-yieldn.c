@@ -41,17 +41,125 @@ static lh_value N_handle_test1() {
   return N_handle(&test1, lh_value_long(20));
 }
 
+// change the operation table back from tail-only while its analysis is cached (under an outer handler)
+static lh_value N_switch_action(lh_value arg) {
+  unreferenced(arg);
+  long s = lh_long_value(N_handle_test1());
+  _N_ops[0].opkind = LH_OP_SCOPED;
+  s += lh_long_value(N_handle_test1());
+  return lh_value_long(s);
+}
+
+
+/*-----------------------------------------------------------------
+  Operations with a fixed number of arguments
+-----------------------------------------------------------------*/
+LH_DEFINE_EFFECT3(F, sum3, pick, stop)
+LH_DEFINE_OP3(F, sum3, long, long, long, long)
+LH_DEFINE_OP2(F, pick, long, long, long)
+LH_DEFINE_VOIDOP4(F, stop, long, long, long, long)
+
+static lh_value _F_sum3(lh_resume r, lh_value local, lh_value arg) {
+  const yieldargs* ya = lh_yieldargs_fixed_value(arg);
+  long x = lh_long_value(ya->args[0]) + lh_long_value(ya->args[1]) + lh_long_value(ya->args[2]);
+  return lh_tail_resume(r, local, lh_value_long(x));
+}
+
+// resumes twice and reads the arguments again after resuming
+static lh_value _F_pick(lh_resume r, lh_value local, lh_value arg) {
+  const yieldargs* ya = lh_yieldargs_fixed_value(arg);
+  long x = lh_long_value(lh_call_resume(r, local, ya->args[0]));
+  long y = lh_long_value(lh_release_resume(r, local, ya->args[1]));
+  return lh_value_long(x + y + ya->argcount);
+}
+
+static lh_value _F_stop(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(r);
+  unreferenced(local);
+  const yieldargs* ya = lh_yieldargs_fixed_value(arg);
+  long x = 0;
+  for (int i = 0; i < ya->argcount; i++) x = 10*x + lh_long_value(ya->args[i]);
+  return lh_value_long(x);
+}
+
+static const lh_operation _F_ops[] = {
+  { LH_OP_TAIL, LH_OPTAG(F,sum3), &_F_sum3 },
+  { LH_OP_GENERAL, LH_OPTAG(F,pick), &_F_pick },
+  { LH_OP_NORESUME, LH_OPTAG(F,stop), &_F_stop },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef _F_def = { LH_EFFECT(F), NULL, NULL, NULL, _F_ops };
+
+static lh_value F_pick_action(lh_value arg) {
+  long x = F_sum3(lh_long_value(arg), 2, 3);
+  long y = F_pick(10, 20);
+  return lh_value_long(100*x + y);
+}
+
+static lh_value F_stop_action(lh_value arg) {
+  F_stop(lh_long_value(arg), 2, 3, 4);
+  return lh_value_long(0);
+}
+
+static long F_handle_test(lh_actionfun* action) {
+  return lh_long_value(lh_handle(&_F_def, lh_value_null, action, lh_value_long(1)));
+}
+
+
+/*-----------------------------------------------------------------
+  Operation tables are validated when a handler definition is prepared
+-----------------------------------------------------------------*/
+LH_DEFINE_EFFECT2(P, first, second)
+
+static lh_value _P_op(lh_resume r, lh_value local, lh_value arg) {
+  return lh_tail_resume(r, local, arg);
+}
+
+static const lh_operation _P_swapped_ops[] = {
+  { LH_OP_TAIL, LH_OPTAG(P,second), &_P_op },
+  { LH_OP_TAIL, LH_OPTAG(P,first), &_P_op },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef _P_swapped_def = { LH_EFFECT(P), NULL, NULL, NULL, _P_swapped_ops };
+
+static const lh_operation _P_partial_ops[] = {
+  { LH_OP_TAIL, LH_OPTAG(P,first), &_P_op },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef _P_partial_def = { LH_EFFECT(P), NULL, NULL, NULL, _P_partial_ops };
+
+static void on_invalid(int err, const char* msg) {
+  unreferenced(err);
+  test_printf("invalid: %s\n", msg);
+}
+
 static void run() {
   lh_value res1 = N_handle_test1();
   test_printf("test sum1: %li\n", lh_long_value(res1));
   _N_ops[0].opkind = LH_OP_TAIL;
   lh_value res2 = N_handle_test1();
   test_printf("test sum2: %li\n", lh_long_value(res2));
+  long res3 = F_handle_test(&F_pick_action);
+  long res4 = F_handle_test(&F_stop_action);
+  test_printf("fixed args: %li, %li\n", res3, res4);
+  test_printf("test sum3: %li\n", F_handle_test(&N_switch_action));
+  lh_register_onfatal(&on_invalid);
+  lh_handlerdef_prepare(&_N_def);
+  lh_handlerdef_prepare(&_P_swapped_def);
+  lh_handlerdef_prepare(&_P_partial_def);
+  lh_handlerdef_prepare(&_P_partial_def);  // invalid definitions are not cached
+  lh_register_onfatal(NULL);
 }
 
 void test_yieldn() {
   test("yieldn", run,
     "test sum1: 42\n"
     "test sum2: 42\n"
+    "fixed args: 1232, 1234\n"
+    "test sum3: 84\n"
+    "invalid: handler operation 0 is not 'P/first' (operations must be in the same order as declared)\n"
+    "invalid: handler operation 1 is not 'P/second' (operations must be in the same order as declared)\n"
+    "invalid: handler for 'P' does not define operation 'P/second'\n"
+    "invalid: handler for 'P' does not define operation 'P/second'\n"
   );
 }
@@ -90,6 +90,11 @@ void test_tailops();
 void test_state_alloc();
 void test_yieldn();
 void test_exn();  // builtin exceptions
+void test_sepstack();
+void test_compact();
+void test_profile();
+
+lh_value multi_state_handle(lh_value(*action)(lh_value), lh_value arg);
 
 /*-----------------------------------------------------------------
   List of lh_value's; Declared in tests_amb